@@ -0,0 +1,273 @@
+/*
+ * Loader and relay for the CS421Net XDP fast path.
+ *
+ * Attaches cs421net_xdp.bpf.o to a network interface and relays every
+ * payload its ring buffer yields to /dev/cs421net, many per writev(),
+ * until interrupted. While it runs, nf_cs421net's xdp_max_len is set
+ * to CS421NET_XDP_MSG_MAX: its netfilter hook leaves the payloads the
+ * XDP program relays alone, so that none is delivered twice, but still
+ * takes the longer ones the program passes on.
+ *
+ * To try it without a NIC that supports XDP, use generic mode on
+ * loopback or on one end of a veth pair:
+ *
+ *   ./cs421net-xdp -g lo
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <linux/if_link.h>
+#include <net/if.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <bpf/bpf.h>
+#include <bpf/libbpf.h>
+
+#include "cs421net_xdp.h"
+
+#define INGEST_PATH "/dev/cs421net"
+#define XDP_MAX_LEN_PATH "/sys/module/nf_cs421net/parameters/xdp_max_len"
+
+/* most payloads relayed per writev() */
+#define RELAY_BATCH 256
+
+struct relay {
+	int ingest_fd;
+	unsigned n;
+	struct cs421net_xdp_msg msgs[RELAY_BATCH];
+	struct iovec iov[RELAY_BATCH];
+	unsigned long relayed;
+	unsigned long failed;
+};
+
+static volatile sig_atomic_t stopping;
+
+static void on_signal(int sig)
+{
+	stopping = 1;
+}
+
+/**
+ * set_xdp_max_len() - set the longest payload the netfilter hook
+ * leaves to this relay
+ *
+ * Return: true on success
+ */
+static bool set_xdp_max_len(unsigned len)
+{
+	int fd = open(XDP_MAX_LEN_PATH, O_WRONLY);
+	char buf[16];
+	int n;
+	bool ok;
+
+	if (fd < 0)
+		return false;
+	n = snprintf(buf, sizeof(buf), "%u", len);
+	ok = write(fd, buf, n) == n;
+	close(fd);
+	return ok;
+}
+
+/**
+ * relay_flush() - write all payloads gathered so far to /dev/cs421net
+ */
+static void relay_flush(struct relay *relay)
+{
+	ssize_t written;
+
+	if (!relay->n)
+		return;
+	written = writev(relay->ingest_fd, relay->iov, relay->n);
+	if (written < 0) {
+		perror("writev " INGEST_PATH);
+		relay->failed += relay->n;
+	} else
+		relay->relayed += relay->n;
+	relay->n = 0;
+}
+
+/**
+ * relay_msg() - ring buffer callback, gather one payload
+ */
+static int relay_msg(void *ctx, void *data, size_t size)
+{
+	struct relay *relay = ctx;
+	const struct cs421net_xdp_msg *msg = data;
+
+	if (size < sizeof(*msg) || !msg->len || msg->len > CS421NET_XDP_MSG_MAX)
+		return 0;
+	relay->msgs[relay->n] = *msg;
+	relay->iov[relay->n].iov_base = relay->msgs[relay->n].data;
+	relay->iov[relay->n].iov_len = msg->len;
+	if (++relay->n == RELAY_BATCH)
+		relay_flush(relay);
+	return 0;
+}
+
+/**
+ * print_stats() - sum and print the XDP program's per-CPU counters
+ */
+static void print_stats(int stats_fd)
+{
+	static const char *const names[CS421NET_XDP_STAT_MAX] = {
+		[CS421NET_XDP_STAT_SEEN] = "seen",
+		[CS421NET_XDP_STAT_QUEUED] = "queued",
+		[CS421NET_XDP_STAT_INVALID] = "invalid",
+		[CS421NET_XDP_STAT_OVERSIZE] = "oversize",
+		[CS421NET_XDP_STAT_OVERFLOW] = "overflow",
+		[CS421NET_XDP_STAT_RETRANSMIT] = "retransmit",
+	};
+	int cpus = libbpf_num_possible_cpus();
+	__u64 *values;
+	__u32 key;
+
+	if (cpus <= 0)
+		return;
+	values = calloc(cpus, sizeof(*values));
+	if (!values)
+		return;
+	for (key = 0; key < CS421NET_XDP_STAT_MAX; key++) {
+		unsigned long long sum = 0;
+
+		if (bpf_map_lookup_elem(stats_fd, &key, values))
+			continue;
+		for (int cpu = 0; cpu < cpus; cpu++)
+			sum += values[cpu];
+		printf("%s: %llu\n", names[key], sum);
+	}
+	free(values);
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s [-g] [-d] [-o OBJECT] IFNAME\n"
+		"  -g  attach in generic (skb) mode, e.g. for lo or veth\n"
+		"  -d  drop captured packets instead of passing them on\n"
+		"  -o  BPF object to load (default: cs421net_xdp.bpf.o)\n",
+		prog);
+}
+
+int main(int argc, char *argv[])
+{
+	const char *object_path = "cs421net_xdp.bpf.o";
+	__u32 xdp_flags = XDP_FLAGS_UPDATE_IF_NOEXIST;
+	struct bpf_object *obj = NULL;
+	struct ring_buffer *rb = NULL;
+	struct bpf_program *prog;
+	static struct relay relay;
+	__u32 key, drop = 0;
+	int ifindex, prog_fd, config_fd, stats_fd;
+	bool attached = false, handed_over = false;
+	int retval = 1;
+	int opt, err;
+
+	while ((opt = getopt(argc, argv, "gdo:h")) != -1) {
+		switch (opt) {
+		case 'g':
+			xdp_flags |= XDP_FLAGS_SKB_MODE;
+			break;
+		case 'd':
+			drop = 1;
+			break;
+		case 'o':
+			object_path = optarg;
+			break;
+		default:
+			usage(argv[0]);
+			return opt == 'h' ? 0 : 1;
+		}
+	}
+	if (optind != argc - 1) {
+		usage(argv[0]);
+		return 1;
+	}
+	ifindex = if_nametoindex(argv[optind]);
+	if (!ifindex) {
+		fprintf(stderr, "unknown interface %s\n", argv[optind]);
+		return 1;
+	}
+
+	relay.ingest_fd = open(INGEST_PATH, O_WRONLY);
+	if (relay.ingest_fd < 0) {
+		perror("open " INGEST_PATH);
+		return 1;
+	}
+	obj = bpf_object__open_file(object_path, NULL);
+	if (!obj || libbpf_get_error(obj)) {
+		fprintf(stderr, "could not open %s\n", object_path);
+		obj = NULL;
+		goto out;
+	}
+	if (bpf_object__load(obj)) {
+		fprintf(stderr, "could not load %s\n", object_path);
+		goto out;
+	}
+	prog = bpf_object__find_program_by_name(obj, "cs421net_xdp");
+	config_fd = bpf_object__find_map_fd_by_name(obj, "config");
+	stats_fd = bpf_object__find_map_fd_by_name(obj, "stats");
+	if (!prog || config_fd < 0 || stats_fd < 0) {
+		fprintf(stderr, "%s is not the CS421Net XDP program\n", object_path);
+		goto out;
+	}
+	key = CS421NET_XDP_CONFIG_DROP;
+	if (bpf_map_update_elem(config_fd, &key, &drop, BPF_ANY)) {
+		perror("configuring XDP program");
+		goto out;
+	}
+	rb = ring_buffer__new(bpf_object__find_map_fd_by_name(obj, "messages"),
+			      relay_msg, &relay, NULL);
+	if (!rb) {
+		fprintf(stderr, "could not open the ring buffer\n");
+		goto out;
+	}
+
+	prog_fd = bpf_program__fd(prog);
+	err = bpf_xdp_attach(ifindex, prog_fd, xdp_flags, NULL);
+	if (err) {
+		fprintf(stderr, "could not attach to %s: %s\n", argv[optind], strerror(-err));
+		goto out;
+	}
+	attached = true;
+	if (!set_xdp_max_len(CS421NET_XDP_MSG_MAX))
+		fprintf(stderr, "could not set %s, payloads may arrive twice\n", XDP_MAX_LEN_PATH);
+	else
+		handed_over = true;
+
+	signal(SIGINT, on_signal);
+	signal(SIGTERM, on_signal);
+	printf("relaying CS421Net payloads from %s, interrupt to stop\n", argv[optind]);
+	while (!stopping) {
+		err = ring_buffer__poll(rb, 100);
+		if (err < 0 && err != -EINTR) {
+			fprintf(stderr, "ring buffer: %s\n", strerror(-err));
+			break;
+		}
+		relay_flush(&relay);
+	}
+	printf("relayed %lu payloads, %lu failed\n", relay.relayed, relay.failed);
+	print_stats(stats_fd);
+	retval = 0;
+
+out:
+	if (handed_over)
+		set_xdp_max_len(0);
+	if (attached)
+		bpf_xdp_detach(ifindex, xdp_flags & ~XDP_FLAGS_UPDATE_IF_NOEXIST, NULL);
+	ring_buffer__free(rb);
+	bpf_object__close(obj);
+	close(relay.ingest_fd);
+	return retval;
+}
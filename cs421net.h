@@ -24,6 +24,17 @@
  */
 void cs421net_init(void);
 
+/**
+ * Open an additional connection to the server.
+ *
+ * Unlike cs421net_init(), failure is reported to the caller instead
+ * of aborting, so that load generators can open many connections.
+ * Nagle's algorithm is disabled on the returned socket.
+ *
+ * @return connected socket, or -1 on error
+ */
+int cs421net_connect(void);
+
 /**
  * Send a message to the server.
  *
@@ -35,3 +46,16 @@ void cs421net_init(void);
  * @return true if data successfully sent, false if not
  */
 bool cs421net_send(const void *buffer, size_t buffer_len);
+
+/**
+ * Send a message over a connection returned by cs421net_connect().
+ *
+ * Unlike cs421net_send(), this does not pause after sending.
+ *
+ * @param[in] sock connected socket
+ * @param[in] buffer buffer containing data to send
+ * @param[in] buffer_len number of bytes to send
+ *
+ * @return true if data successfully sent, false if not
+ */
+bool cs421net_send_fd(int sock, const void *buffer, size_t buffer_len);
@@ -0,0 +1,167 @@
+/*
+ * XDP fast path for CS421Net: recognize code-change packets at the
+ * driver and put them on a ring buffer, for cs421net-xdp to relay to
+ * /dev/cs421net. Only one message per segment is supported, as with
+ * the netfilter hook's default framing. Retransmitted segments are
+ * recognized by their flow and sequence number and not relayed again.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#include <linux/bpf.h>
+#include <linux/if_ether.h>
+#include <linux/in.h>
+#include <linux/ip.h>
+#include <linux/tcp.h>
+#include <stdbool.h>
+
+#include <bpf/bpf_endian.h>
+#include <bpf/bpf_helpers.h>
+
+#include "cs421net_xdp.h"
+
+struct {
+	__uint(type, BPF_MAP_TYPE_RINGBUF);
+	__uint(max_entries, 1 << 20);
+} messages SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_ARRAY);
+	__uint(max_entries, CS421NET_XDP_CONFIG_MAX);
+	__type(key, __u32);
+	__type(value, __u32);
+} config SEC(".maps");
+
+struct {
+	__uint(type, BPF_MAP_TYPE_PERCPU_ARRAY);
+	__uint(max_entries, CS421NET_XDP_STAT_MAX);
+	__type(key, __u32);
+	__type(value, __u64);
+} stats SEC(".maps");
+
+/**
+ * struct cs421net_xdp_seg - a segment, as told apart from others
+ * @saddr: source address
+ * @daddr: destination address
+ * @sport: source port
+ * @dport: destination port
+ * @seq: sequence number, as sent
+ */
+struct cs421net_xdp_seg {
+	__be32 saddr;
+	__be32 daddr;
+	__be16 sport;
+	__be16 dport;
+	__be32 seq;
+};
+
+/* segments relayed lately, and their payload lengths */
+struct {
+	__uint(type, BPF_MAP_TYPE_LRU_HASH);
+	__uint(max_entries, 16384);
+	__type(key, struct cs421net_xdp_seg);
+	__type(value, __u32);
+} relayed SEC(".maps");
+
+static __always_inline void count(__u32 stat)
+{
+	__u64 *value = bpf_map_lookup_elem(&stats, &stat);
+
+	if (value)
+		(*value)++;
+}
+
+static __always_inline int verdict(void)
+{
+	__u32 key = CS421NET_XDP_CONFIG_DROP;
+	__u32 *drop = bpf_map_lookup_elem(&config, &key);
+
+	return drop && *drop ? XDP_DROP : XDP_PASS;
+}
+
+/**
+ * cs421net_xdp() - capture payloads sent to the CS421Net port
+ * @ctx: the packet
+ *
+ * Every payload of a TCP segment to CS421NET_XDP_PORT is put on the
+ * ring buffer, unless a segment of the same flow and sequence number
+ * already was: a retransmission is counted, and then handled like a
+ * captured packet. Invalid payloads are relayed as well, so that
+ * mastermind still counts them, but are tallied here first: a code
+ * change is CS421NET_XDP_CODE_LEN decimal digits, and whether its
+ * colors are in range is left to mastermind. Packets that cannot be
+ * captured, and all other traffic, are passed on untouched.
+ *
+ * Return: XDP_DROP for captured and retransmitted packets if so
+ * configured, else XDP_PASS
+ */
+SEC("xdp")
+int cs421net_xdp(struct xdp_md *ctx)
+{
+	void *data = (void *)(long)ctx->data;
+	void *data_end = (void *)(long)ctx->data_end;
+	struct cs421net_xdp_seg seg = {};
+	struct cs421net_xdp_msg *msg;
+	struct ethhdr *eth = data;
+	struct iphdr *iph;
+	struct tcphdr *tcph;
+	__u8 *payload;
+	__u32 hdr_len, len, i;
+	bool valid;
+
+	if ((void *)(eth + 1) > data_end || eth->h_proto != bpf_htons(ETH_P_IP))
+		return XDP_PASS;
+	iph = (void *)(eth + 1);
+	if ((void *)(iph + 1) > data_end || iph->protocol != IPPROTO_TCP ||
+	    iph->ihl < 5 || (iph->frag_off & bpf_htons(0x3fff)))
+		return XDP_PASS;
+	tcph = (void *)iph + iph->ihl * 4;
+	if ((void *)(tcph + 1) > data_end || tcph->dest != bpf_htons(CS421NET_XDP_PORT))
+		return XDP_PASS;
+	hdr_len = iph->ihl * 4 + tcph->doff * 4;
+	if (bpf_ntohs(iph->tot_len) <= hdr_len)
+		return XDP_PASS;
+	len = bpf_ntohs(iph->tot_len) - hdr_len;
+	payload = (void *)tcph + tcph->doff * 4;
+
+	count(CS421NET_XDP_STAT_SEEN);
+	if (len > CS421NET_XDP_MSG_MAX || (void *)(payload + len) > data_end) {
+		count(CS421NET_XDP_STAT_OVERSIZE);
+		return XDP_PASS;
+	}
+	seg.saddr = iph->saddr;
+	seg.daddr = iph->daddr;
+	seg.sport = tcph->source;
+	seg.dport = tcph->dest;
+	seg.seq = tcph->seq;
+	if (bpf_map_lookup_elem(&relayed, &seg)) {
+		count(CS421NET_XDP_STAT_RETRANSMIT);
+		return verdict();
+	}
+	msg = bpf_ringbuf_reserve(&messages, sizeof(*msg), 0);
+	if (!msg) {
+		count(CS421NET_XDP_STAT_OVERFLOW);
+		return XDP_PASS;
+	}
+	valid = len == CS421NET_XDP_CODE_LEN;
+	for (i = 0; i < CS421NET_XDP_MSG_MAX && i < len; i++) {
+		if ((void *)(payload + i + 1) > data_end) {
+			bpf_ringbuf_discard(msg, 0);
+			return XDP_PASS;
+		}
+		msg->data[i] = payload[i];
+		if (payload[i] < '0' || payload[i] > '9')
+			valid = false;
+	}
+	msg->len = len;
+	bpf_map_update_elem(&relayed, &seg, &len, BPF_ANY);
+	bpf_ringbuf_submit(msg, 0);
+	count(CS421NET_XDP_STAT_QUEUED);
+	if (!valid)
+		count(CS421NET_XDP_STAT_INVALID);
+	return verdict();
+}
+
+char LICENSE[] SEC("license") = "GPL";
@@ -0,0 +1,60 @@
+/*
+ * Declarations shared by the CS421Net XDP program and its loader.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#ifndef CS421NET_XDP_H
+#define CS421NET_XDP_H
+
+#define CS421NET_XDP_PORT 4210
+
+/* length of a code-change message */
+#define CS421NET_XDP_CODE_LEN 4
+
+/*
+ * longest payload relayed; longer ones are passed on to the netfilter
+ * hook, as the loader sets nf_cs421net's xdp_max_len to this
+ */
+#define CS421NET_XDP_MSG_MAX 64
+
+/**
+ * struct cs421net_xdp_msg - one payload captured by the XDP program
+ * @len: number of bytes in @data
+ * @data: the payload, NOT null-terminated
+ */
+struct cs421net_xdp_msg {
+	__u32 len;
+	__u8 data[CS421NET_XDP_MSG_MAX];
+};
+
+/* keys of the config map */
+enum cs421net_xdp_config {
+	/* nonzero: drop captured packets instead of passing them on */
+	CS421NET_XDP_CONFIG_DROP,
+	CS421NET_XDP_CONFIG_MAX,
+};
+
+/* keys of the per-CPU stats map */
+enum cs421net_xdp_stat {
+	/* payloads to the CS421Net port */
+	CS421NET_XDP_STAT_SEEN,
+	/* payloads put on the ring buffer */
+	CS421NET_XDP_STAT_QUEUED,
+	/* queued payloads that cannot be a code change */
+	CS421NET_XDP_STAT_INVALID,
+	/* payloads longer than CS421NET_XDP_MSG_MAX, passed on */
+	CS421NET_XDP_STAT_OVERSIZE,
+	/*
+	 * payloads passed on because the ring buffer was full, which the
+	 * netfilter hook then leaves alone too: they are lost
+	 */
+	CS421NET_XDP_STAT_OVERFLOW,
+	/* retransmitted payloads, not relayed again */
+	CS421NET_XDP_STAT_RETRANSMIT,
+	CS421NET_XDP_STAT_MAX,
+};
+
+#endif
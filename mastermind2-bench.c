@@ -0,0 +1,593 @@
+/*
+ * Load generator and end-to-end benchmark for CS421Net code changes.
+ *
+ * Sends code-change messages through cs421net_send_fd() over many
+ * connections, mixing valid and invalid payloads, then confirms via
+ * /sys/devices/platform/mastermind/stats that the module counted
+ * every message. TCP may merge writes into one segment, so merged
+ * messages are allowed for, unless nf_cs421net's framing parameter is 2
+ * and the load can be sent length-prefixed; -F sets it for the run.
+ *
+ * Afterwards it measures how long a single code change takes to become
+ * visible through /dev/mm. nf_cs421net's netfilter hook queues the
+ * message for its workqueue. By default, the workqueue hands it straight
+ * to the consumer mastermind2 registered. With mastermind2's net_irq
+ * parameter set, it raises the CS421Net IRQ instead, and the IRQ's
+ * threaded bottom half reads the message. Either way, the fan-out work
+ * then gives the code to every game.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cs421net.h"
+
+#define NUM_PEGS 4
+#define STATS_PATH "/sys/devices/platform/mastermind/stats"
+#define FRAMING_PATH "/sys/module/nf_cs421net/parameters/framing"
+#define FRAMING_LENGTH 2
+/* CS421NET_PORT as it appears in /proc/net/tcp */
+#define PORT_HEX "1072"
+/* how long the counters must stay put before unframed load is judged */
+#define QUIET_NS 200000000LL
+
+struct mm_stats {
+	long colors;
+	long changed;
+	long invalid;
+};
+
+struct bench_options {
+	unsigned connections;
+	unsigned long messages;
+	unsigned long rate;
+	unsigned invalid_percent;
+	unsigned latency_samples;
+	unsigned poll_usec;
+	unsigned timeout_ms;
+	unsigned seed;
+	bool set_framing;
+};
+
+/**
+ * now_ns() - monotonic clock in nanoseconds
+ */
+static long long now_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+/**
+ * sleep_until_ns() - sleep until an absolute CLOCK_MONOTONIC deadline
+ * @deadline: deadline in nanoseconds
+ */
+static void sleep_until_ns(long long deadline)
+{
+	struct timespec ts;
+
+	ts.tv_sec = deadline / 1000000000LL;
+	ts.tv_nsec = deadline % 1000000000LL;
+	while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+		;
+}
+
+/**
+ * read_stats() - parse the module's sysfs statistics
+ * @stats: *OUT* parameter to store parsed counters
+ *
+ * Return: true on success, false if the file could not be parsed
+ */
+static bool read_stats(struct mm_stats *stats)
+{
+	char line[128];
+	FILE *f = fopen(STATS_PATH, "r");
+	unsigned found = 0;
+
+	if (!f) {
+		perror(STATS_PATH);
+		return false;
+	}
+	while (fgets(line, sizeof(line), f)) {
+		if (sscanf(line, "Number of colors: %ld", &stats->colors) == 1)
+			found |= 1;
+		else if (sscanf(line, "Number of times code was changed: %ld", &stats->changed) == 1)
+			found |= 2;
+		else if (sscanf(line, "Number of invalid code change attempts: %ld", &stats->invalid) == 1)
+			found |= 4;
+	}
+	fclose(f);
+	return found == 7;
+}
+
+/**
+ * read_framing() - read nf_cs421net's framing parameter
+ *
+ * Return: its value, or -1 if it could not be read
+ */
+static int read_framing(void)
+{
+	FILE *f = fopen(FRAMING_PATH, "r");
+	int framing = -1;
+
+	if (!f)
+		return -1;
+	if (fscanf(f, "%d", &framing) != 1)
+		framing = -1;
+	fclose(f);
+	return framing;
+}
+
+/**
+ * write_framing() - set nf_cs421net's framing parameter
+ * @framing: new value
+ *
+ * Return: true on success, false if not permitted or not loaded
+ */
+static bool write_framing(int framing)
+{
+	FILE *f = fopen(FRAMING_PATH, "w");
+	bool ok;
+
+	if (!f)
+		return false;
+	ok = fprintf(f, "%d\n", framing) > 0;
+	return fclose(f) == 0 && ok;
+}
+
+/**
+ * port_connections() - count open TCP connections to or from
+ * CS421NET_PORT
+ *
+ * Listening sockets and connections being closed are not counted, as
+ * nf_cs421net is no longer reassembling a stream for them.
+ *
+ * Return: number of connections, or -1 if /proc/net/tcp is unreadable
+ */
+static long port_connections(void)
+{
+	static const char *const paths[] = { "/proc/net/tcp", "/proc/net/tcp6" };
+	char line[256], local[64], remote[64];
+	unsigned state;
+	long n = 0;
+
+	for (size_t i = 0; i < sizeof(paths) / sizeof(paths[0]); i++) {
+		FILE *f = fopen(paths[i], "r");
+
+		if (!f) {
+			if (!i)
+				return -1;
+			continue;
+		}
+		while (fgets(line, sizeof(line), f)) {
+			if (sscanf(line, " %*u: %63s %63s %x", local, remote, &state) != 3)
+				continue;
+			/* LISTEN, TIME_WAIT and CLOSE */
+			if (state == 0x0a || state == 0x06 || state == 0x07)
+				continue;
+			if (!strcmp(strchr(local, ':') + 1, PORT_HEX) ||
+			    !strcmp(strchr(remote, ':') + 1, PORT_HEX))
+				n++;
+		}
+		fclose(f);
+	}
+	return n;
+}
+
+/**
+ * make_valid_code() - fill @code with a random code using @colors colors
+ */
+static void make_valid_code(char *code, long colors)
+{
+	for (size_t i = 0; i < NUM_PEGS; i++)
+		code[i] = '0' + rand() % colors;
+}
+
+/**
+ * make_invalid_code() - fill @code with a payload the module must reject
+ * @code: destination buffer, at least NUM_PEGS + 1 bytes
+ * @colors: current number of colors
+ *
+ * Rotates between a short payload, a long payload, a non-digit
+ * character, and a digit outside the color range.
+ *
+ * Return: length of the payload
+ */
+static size_t make_invalid_code(char *code, long colors)
+{
+	make_valid_code(code, colors);
+	switch (rand() % 4) {
+	case 0:
+		return NUM_PEGS - 1;
+	case 1:
+		code[NUM_PEGS] = '0';
+		return NUM_PEGS + 1;
+	case 2:
+		code[rand() % NUM_PEGS] = 'x';
+		return NUM_PEGS;
+	default:
+		if (colors > 9)
+			code[rand() % NUM_PEGS] = 'x';
+		else
+			code[rand() % NUM_PEGS] = '0' + colors;
+		return NUM_PEGS;
+	}
+}
+
+/**
+ * run_load() - send messages round-robin over many connections
+ * @opts: benchmark options
+ * @colors: current number of colors
+ * @framed: prefix each message with its big-endian 16-bit length
+ * @sent_valid: *OUT* parameter, number of valid messages sent
+ * @sent_invalid: *OUT* parameter, number of invalid messages sent
+ *
+ * Return: true if every message was sent
+ */
+static bool run_load(const struct bench_options *opts, long colors, bool framed,
+		     unsigned long *sent_valid, unsigned long *sent_invalid)
+{
+	int *socks = calloc(opts->connections, sizeof(*socks));
+	long long interval = opts->rate ? 1000000000LL / opts->rate : 0;
+	long long start, deadline, elapsed;
+	char frame[2 + NUM_PEGS + 1];
+	char *code = frame + 2;
+	size_t len;
+	unsigned opened;
+	bool ok = true;
+
+	if (!socks)
+		return false;
+	for (opened = 0; opened < opts->connections; opened++) {
+		socks[opened] = cs421net_connect();
+		if (socks[opened] < 0) {
+			fprintf(stderr, "connection %u failed\n", opened);
+			ok = false;
+			goto out;
+		}
+	}
+
+	*sent_valid = 0;
+	*sent_invalid = 0;
+	start = now_ns();
+	deadline = start;
+	for (unsigned long m = 0; m < opts->messages; m++) {
+		bool invalid = (unsigned)(rand() % 100) < opts->invalid_percent;
+
+		if (invalid)
+			len = make_invalid_code(code, colors);
+		else {
+			make_valid_code(code, colors);
+			len = NUM_PEGS;
+		}
+		frame[0] = len >> 8;
+		frame[1] = len & 0xff;
+		if (!cs421net_send_fd(socks[m % opts->connections],
+				      framed ? frame : code, framed ? len + 2 : len)) {
+			ok = false;
+			break;
+		}
+		if (invalid)
+			(*sent_invalid)++;
+		else
+			(*sent_valid)++;
+		if (interval) {
+			deadline += interval;
+			sleep_until_ns(deadline);
+		}
+	}
+	elapsed = now_ns() - start;
+	printf("load: %lu valid + %lu invalid messages over %u connections in %.3f s (%.0f msg/s)\n",
+	       *sent_valid, *sent_invalid, opts->connections, elapsed / 1e9,
+	       elapsed ? (*sent_valid + *sent_invalid) * 1e9 / elapsed : 0.0);
+
+out:
+	while (opened--)
+		close(socks[opened]);
+	free(socks);
+	return ok;
+}
+
+/**
+ * verify_counts() - wait for the module to account for every message
+ * @opts: benchmark options
+ * @before: statistics before the load phase
+ * @framed: whether the load was sent length-prefixed
+ * @sent_valid: number of valid messages sent
+ * @sent_invalid: number of invalid messages sent
+ *
+ * Framed messages must be counted exactly. Unframed ones may have been
+ * merged by TCP: k messages in one segment count as one invalid
+ * message, so @sent_valid - valid may be at most twice the number of
+ * messages missing in total. Unframed counts are judged once they stop
+ * changing for QUIET_NS, as they may never reach the number sent.
+ *
+ * Return: true if the stats deltas match what was sent
+ */
+static bool verify_counts(const struct bench_options *opts, const struct mm_stats *before,
+			  bool framed, unsigned long sent_valid, unsigned long sent_invalid)
+{
+	long long deadline = now_ns() + opts->timeout_ms * 1000000LL;
+	long long start = now_ns(), quiet = start;
+	long sent = sent_valid + sent_invalid;
+	long total, last_total = -1;
+	struct mm_stats after;
+	long valid, invalid;
+
+	do {
+		if (!read_stats(&after))
+			return false;
+		valid = after.changed - before->changed;
+		invalid = after.invalid - before->invalid;
+		total = valid + invalid;
+		if (total >= sent)
+			break;
+		if (total != last_total) {
+			last_total = total;
+			quiet = now_ns();
+		} else if (!framed && now_ns() - quiet >= QUIET_NS)
+			break;
+		sleep_until_ns(now_ns() + 1000000LL);
+	} while (now_ns() < deadline);
+
+	printf("stats: %ld valid (expected %lu), %ld invalid (expected %lu), drained in %.3f s\n",
+	       valid, sent_valid, invalid, sent_invalid, (now_ns() - start) / 1e9);
+	if (framed)
+		return valid == (long)sent_valid && invalid == (long)sent_invalid;
+	if (total < sent)
+		printf("stats: %ld messages merged into others by TCP\n", sent - total);
+	return valid <= (long)sent_valid && total <= sent &&
+	       (long)sent_valid - valid <= 2 * (sent - total);
+}
+
+/**
+ * measure_one() - time a single code change until it is visible
+ * @opts: benchmark options
+ * @sock: connection to send the change over
+ * @mm_fd: open descriptor to /dev/mm
+ * @colors: current number of colors
+ * @framed: prefix the change with its big-endian 16-bit length
+ *
+ * Start a fresh game and pick a code it does not already have as its
+ * target, which may be random under the random_codes parameter: a
+ * guess of the code must not win. Then send the code and repeatedly
+ * guess it until the guess wins.
+ *
+ * Return: latency in nanoseconds, or -1 on timeout or error
+ */
+static long long measure_one(const struct bench_options *opts, int sock, int mm_fd, long colors,
+			     bool framed)
+{
+	char frame[2 + NUM_PEGS] = { 0, NUM_PEGS };
+	char *code = frame + 2;
+	char result[NUM_PEGS];
+	long long start, deadline;
+	unsigned tries = 0;
+	int ctl_fd;
+
+	ctl_fd = open("/dev/mm_ctl", O_WRONLY);
+	if (ctl_fd < 0) {
+		perror("/dev/mm_ctl");
+		return -1;
+	}
+	do {
+		if (++tries > 10) {
+			fprintf(stderr, "could not pick a code other than the target\n");
+			close(ctl_fd);
+			return -1;
+		}
+		if (write(ctl_fd, "start", 5) != 5) {
+			perror("/dev/mm_ctl");
+			close(ctl_fd);
+			return -1;
+		}
+		make_valid_code(code, colors);
+		if (write(mm_fd, code, NUM_PEGS) != NUM_PEGS ||
+		    pread(mm_fd, result, NUM_PEGS, 0) != NUM_PEGS) {
+			perror("/dev/mm");
+			close(ctl_fd);
+			return -1;
+		}
+	} while (!memcmp(result, "????", NUM_PEGS) || !memcmp(result, "B4W0", NUM_PEGS));
+	close(ctl_fd);
+
+	start = now_ns();
+	deadline = start + opts->timeout_ms * 1000000LL;
+	if (!cs421net_send_fd(sock, framed ? frame : code, framed ? sizeof(frame) : NUM_PEGS))
+		return -1;
+	do {
+		if (write(mm_fd, code, NUM_PEGS) != NUM_PEGS) {
+			perror("/dev/mm write");
+			return -1;
+		}
+		if (pread(mm_fd, result, NUM_PEGS, 0) != NUM_PEGS) {
+			perror("/dev/mm read");
+			return -1;
+		}
+		/* a winning guess ends the game, so the next read shows "????" */
+		if (!memcmp(result, "????", NUM_PEGS) || !memcmp(result, "B4W0", NUM_PEGS))
+			return now_ns() - start;
+		if (opts->poll_usec)
+			sleep_until_ns(now_ns() + opts->poll_usec * 1000LL);
+	} while (now_ns() < deadline);
+	return -1;
+}
+
+static int compare_ll(const void *a, const void *b)
+{
+	long long x = *(const long long *)a, y = *(const long long *)b;
+
+	return (x > y) - (x < y);
+}
+
+/**
+ * run_latency() - measure end-to-end code change propagation
+ * @opts: benchmark options
+ * @colors: current number of colors
+ * @framed: whether nf_cs421net expects length-prefixed messages
+ *
+ * Return: true if every sample completed before the timeout
+ */
+static bool run_latency(const struct bench_options *opts, long colors, bool framed)
+{
+	long long *samples;
+	unsigned n = 0, timeouts = 0;
+	long long sum = 0;
+	int sock, mm_fd;
+
+	if (!opts->latency_samples)
+		return true;
+	samples = calloc(opts->latency_samples, sizeof(*samples));
+	sock = cs421net_connect();
+	mm_fd = open("/dev/mm", O_RDWR);
+	if (!samples || sock < 0 || mm_fd < 0) {
+		fprintf(stderr, "could not set up latency measurement\n");
+		free(samples);
+		if (sock >= 0)
+			close(sock);
+		if (mm_fd >= 0)
+			close(mm_fd);
+		return false;
+	}
+
+	for (unsigned i = 0; i < opts->latency_samples; i++) {
+		long long ns = measure_one(opts, sock, mm_fd, colors, framed);
+
+		if (ns < 0) {
+			timeouts++;
+			continue;
+		}
+		samples[n++] = ns;
+		sum += ns;
+	}
+	close(mm_fd);
+	close(sock);
+
+	if (n) {
+		qsort(samples, n, sizeof(*samples), compare_ll);
+		printf("latency: %u samples, min %.1f us, avg %.1f us, p50 %.1f us, p99 %.1f us, max %.1f us\n",
+		       n, samples[0] / 1e3, sum / 1e3 / n, samples[n / 2] / 1e3,
+		       samples[(n * 99) / 100 < n ? (n * 99) / 100 : n - 1] / 1e3,
+		       samples[n - 1] / 1e3);
+	}
+	if (timeouts)
+		printf("latency: %u samples timed out\n", timeouts);
+	free(samples);
+	return timeouts == 0;
+}
+
+static void usage(const char *prog)
+{
+	fprintf(stderr,
+		"Usage: %s [-c connections] [-n messages] [-r rate] [-i invalid%%]\n"
+		"          [-l latency_samples] [-p poll_usec] [-t timeout_ms] [-s seed] [-F]\n"
+		"  -r 0 sends as fast as possible (default)\n"
+		"  -F sets nf_cs421net's framing to 2 for the load, so that messages are\n"
+		"     counted exactly, and restores it afterwards; refused while any other\n"
+		"     connection to port %d is open\n",
+		prog, CS421NET_PORT);
+}
+
+int main(int argc, char *argv[])
+{
+	struct bench_options opts = {
+		.connections = 8,
+		.messages = 1000,
+		.rate = 0,
+		.invalid_percent = 20,
+		.latency_samples = 100,
+		.poll_usec = 50,
+		.timeout_ms = 5000,
+		.seed = 421,
+	};
+	struct mm_stats before;
+	unsigned long sent_valid = 0, sent_invalid = 0;
+	int framing = -1;
+	bool framed = false;
+	bool ok = true;
+	int opt;
+
+	while ((opt = getopt(argc, argv, "c:n:r:i:l:p:t:s:Fh")) != -1) {
+		switch (opt) {
+		case 'c':
+			opts.connections = strtoul(optarg, NULL, 0);
+			break;
+		case 'n':
+			opts.messages = strtoul(optarg, NULL, 0);
+			break;
+		case 'r':
+			opts.rate = strtoul(optarg, NULL, 0);
+			break;
+		case 'i':
+			opts.invalid_percent = strtoul(optarg, NULL, 0);
+			break;
+		case 'l':
+			opts.latency_samples = strtoul(optarg, NULL, 0);
+			break;
+		case 'p':
+			opts.poll_usec = strtoul(optarg, NULL, 0);
+			break;
+		case 't':
+			opts.timeout_ms = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			opts.seed = strtoul(optarg, NULL, 0);
+			break;
+		case 'F':
+			opts.set_framing = true;
+			break;
+		default:
+			usage(argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if (!opts.connections || opts.invalid_percent > 100) {
+		usage(argv[0]);
+		return EXIT_FAILURE;
+	}
+	srand(opts.seed);
+
+	if (!read_stats(&before)) {
+		fprintf(stderr, "could not parse %s\n", STATS_PATH);
+		return EXIT_FAILURE;
+	}
+
+	if (opts.messages) {
+		framing = read_framing();
+		framed = framing == FRAMING_LENGTH;
+		if (!framed && opts.set_framing) {
+			/* a stream in progress would be split differently */
+			if (port_connections() != 0)
+				fprintf(stderr, "connections to port %d are open, leaving %s alone\n",
+					CS421NET_PORT, FRAMING_PATH);
+			else if (framing < 0 || !write_framing(FRAMING_LENGTH))
+				fprintf(stderr, "could not set %s\n", FRAMING_PATH);
+			else
+				framed = true;
+		}
+		if (!framed)
+			printf("load: messages unframed, allowing for merged ones\n");
+		ok = run_load(&opts, before.colors, framed, &sent_valid, &sent_invalid);
+		ok = verify_counts(&opts, &before, framed, sent_valid, sent_invalid) && ok;
+		if (framed && framing != FRAMING_LENGTH && !write_framing(framing))
+			fprintf(stderr, "could not restore %s to %d\n", FRAMING_PATH, framing);
+	}
+	ok = run_latency(&opts, before.colors, read_framing() == FRAMING_LENGTH) && ok;
+
+	printf("%s\n", ok ? "PASS" : "FAIL");
+	return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -1,17 +1,26 @@
+#define _POSIX_C_SOURCE 200809L
+
 #include "cs421net.h"
+#include "mastermind2.h"
 
 /* YOUR CODE HERE */
 #include <errno.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <stdio.h>
 #include <unistd.h>
 #include <signal.h>
+#include <sys/ioctl.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/types.h>
+#include <sys/uio.h>
 #include <sys/user.h>
+#include <sys/wait.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
 
 #define TEST_PART_1
 
@@ -29,10 +38,48 @@
 
 #define TEST_PART_8
 
+#define TEST_PART_9
+
+#define TEST_PART_10
+
+#define TEST_PART_11
+
+#define TEST_PART_12
+
+#define TEST_PART_13
+
+#define TEST_PART_14
+
+#define TEST_PART_15
+
+#define TEST_PART_16
+
+#define TEST_PART_17
+
+#define TEST_PART_18
+
+#define TEST_PART_19
+
+#define TEST_PART_20
+
+#define TEST_PART_21
+
+#define TEST_PART_22
+
+#define TEST_PART_23
+
+#define TEST_PART_24
+
+#define TEST_PART_25
+
+#define TEST_PART_26
+
+#define TEST_PART_27
+
 static unsigned test_passed;
 static unsigned test_failed;
 
-static size_t USER_VIEW_LINE_SIZE = 22;
+static size_t USER_VIEW_LINE_SIZE = 24;
 
 #define CHECK_IS_NOT_NULL(ptrA)             \
 	do                                      \
@@ -166,13 +213,32 @@ void print_user_view(char *user_view)
 {
 	for (size_t i = 0; i < PAGE_SIZE / USER_VIEW_LINE_SIZE; i++)
 	{
-		printf("%s", user_view + (loff_t)(i * USER_VIEW_LINE_SIZE));
+		printf("%s", user_view + i * USER_VIEW_LINE_SIZE);
 	}
 }
 
 void print_stats(char *stats){
 	printf("%s", stats);
 }
+
+/**
+ * read_stat() - reads one counter from the sysfs stats
+ * @label: text preceding the value, including the colon
+ *
+ * Return: the counter, or -1 if it is not listed
+ * */
+long read_stat(const char *label)
+{
+	char buf[PAGE_SIZE] = {0};
+	char *line;
+	read_from_device("/sys/devices/platform/mastermind/stats", buf, PAGE_SIZE - 1);
+	line = strstr(buf, label);
+	if (line == NULL)
+	{
+		return -1;
+	}
+	return strtol(line + strlen(label), NULL, 10);
+}
 /**
  * report_test_results() - prints the current status of tests passed and failed
  * */
@@ -250,10 +316,23 @@ int main(void) {
 	cs421net_init();
 	printf("Checking the network capabilities of the game\n");
 	write_to_device("/dev/mm_ctl", "start", 5);
+	long fanned_out = read_stat("Number of code changes given to every game:");
+	int code_fd = open("/dev/mm", O_RDONLY);
+	read(code_fd, last_result, 4);
 	cs421net_send("4442", 4);
+	/* the code reaches games asynchronously, so wait until this one has it */
+	struct pollfd code_pfd = { .fd = code_fd, .events = POLLIN };
+	CHECK_IS_EQUAL(poll(&code_pfd, 1, 1000), 1);
+	close(code_fd);
 	write_to_device("/dev/mm", "1111", 4);
 	read_from_device("/dev/mm", last_result, 4);
 	CHECK_IS_STRING_EQUAL(last_result, "B0W0", 4);
+	/* other shards may still be busy with their games */
+	struct timespec fanout_wait = { .tv_nsec = 10000000 };
+	for (int tries = 0; tries < 100 &&
+	     read_stat("Number of code changes given to every game:") <= fanned_out; tries++)
+		nanosleep(&fanout_wait, NULL);
+	CHECK_IS_EQUAL(read_stat("Number of code changes given to every game:") > fanned_out, true);
 	read_from_device("/sys/devices/platform/mastermind/stats", stats, PAGE_SIZE);
 	print_stats(stats);
 #endif
@@ -277,6 +356,417 @@ int main(void) {
 		read_from_device("/sys/devices/platform/mastermind/stats", stats, PAGE_SIZE);
 		print_stats(stats);
 	}
+#endif
+/** part 9 plays a game using only the kernel's suggested guesses */
+#ifdef TEST_PART_9
+	printf("Playing a game with MM_IOC_SOLVE suggestions\n");
+	write_to_device("/dev/mm_ctl", "start", 5);
+	int mm_fd = open("/dev/mm", O_RDWR);
+	struct mm_solve solve;
+	CHECK_IS_EQUAL(ioctl(mm_fd, MM_IOC_SOLVE, &solve), 0);
+	CHECK_IS_EQUAL(solve.remaining, solve.space);
+	unsigned solver_guesses = 0;
+	while (solver_guesses < 10 && ioctl(mm_fd, MM_IOC_SOLVE, &solve) == 0) {
+		write(mm_fd, solve.guess, MM_NUM_PEGS);
+		solver_guesses++;
+	}
+	CHECK_IS_NOT_EQUAL(solver_guesses, 10);
+	errno = 0;
+	CHECK_IS_EQUAL(ioctl(mm_fd, MM_IOC_SOLVE, &solve), -1);
+	CHECK_IS_EQUAL(errno, EINVAL);
+	close(mm_fd);
+#endif
+/** part 10 checks that the mapped candidate view agrees with MM_IOC_SOLVE */
+#ifdef TEST_PART_10
+	printf("Checking the mapped candidate view\n");
+	write_to_device("/dev/mm_ctl", "start", 5);
+	mm_fd = open("/dev/mm", O_RDWR);
+	write(mm_fd, "0011", 4);
+	CHECK_IS_EQUAL(ioctl(mm_fd, MM_IOC_SOLVE, &solve), 0);
+	struct mm_candidate_view *view = mmap(NULL, PAGE_SIZE, PROT_READ, MAP_SHARED, mm_fd,
+					      MM_MMAP_CANDIDATES_PGOFF * PAGE_SIZE);
+	CHECK_IS_NOT_EQUAL(view, MAP_FAILED);
+	if (view != MAP_FAILED) {
+		CHECK_IS_EQUAL(view->remaining, solve.remaining);
+		CHECK_IS_EQUAL(view->space, solve.space);
+		munmap(view, PAGE_SIZE);
+	}
+	close(mm_fd);
+#endif
+/** part 11 looks up a winning score in the shared score table */
+#ifdef TEST_PART_11
+	printf("Checking the shared score table\n");
+	write_to_device("/dev/mm_ctl", "start", 5);
+	mm_fd = open("/dev/mm", O_RDONLY);
+	ioctl(mm_fd, MM_IOC_SOLVE, &solve);
+	size_t table_size = (size_t)solve.space * solve.space;
+	unsigned char *table = mmap(NULL, table_size, PROT_READ, MAP_SHARED, mm_fd,
+				    MM_MMAP_SCORES_PGOFF * PAGE_SIZE);
+	if (table != MAP_FAILED) {
+		CHECK_IS_EQUAL(table[0], MM_SCORE(4, 0));
+		CHECK_IS_EQUAL(table[solve.space - 1], MM_SCORE(0, 0));
+		CHECK_IS_EQUAL(table[table_size - 1], MM_SCORE(4, 0));
+		munmap(table, table_size);
+	}
+	else {
+		/* boards above 4096 codes have no table */
+		CHECK_IS_EQUAL(errno, ENODEV);
+	}
+	close(mm_fd);
+#endif
+/** part 12 plays two games at once through separate opens (root only) */
+#ifdef TEST_PART_12
+	if (geteuid() == 0) {
+		printf("Playing two games on separate file descriptors\n");
+		const char *param = "/sys/module/mastermind2/parameters/per_file_games";
+		write_to_device(param, "1", 1);
+		int game_a = open("/dev/mm", O_RDWR);
+		int game_b = open("/dev/mm", O_RDWR);
+		CHECK_IS_EQUAL(write(game_a, "4211", 4), 4);
+		CHECK_IS_EQUAL(write(game_b, "1111", 4), 4);
+		pread(game_a, last_result, 4, 0);
+		CHECK_IS_STRING_EQUAL(last_result, "????", 4);
+		pread(game_b, last_result, 4, 0);
+		CHECK_IS_STRING_EQUAL(last_result, "B2W0", 4);
+		close(game_a);
+		close(game_b);
+		write_to_device(param, "0", 1);
+	}
+#endif
+/** part 13 makes another user's game evict ours under max_games (root only) */
+#ifdef TEST_PART_13
+	if (geteuid() == 0) {
+		printf("Evicting the least recently used game\n");
+		const char *max_games = "/sys/module/mastermind2/parameters/max_games";
+		long evicted = read_stat("Number of games evicted by limits:");
+		CHECK_IS_NOT_EQUAL(evicted, -1);
+		write_to_device("/dev/mm_ctl", "start", 5);
+		write_to_device(max_games, "1", 1);
+		pid_t child = fork();
+		if (child == 0) {
+			char buf[4];
+			if (setuid(65534) == 0)
+				read_from_device("/dev/mm", buf, 4);
+			_exit(0);
+		}
+		waitpid(child, NULL, 0);
+		CHECK_IS_EQUAL(read_stat("Number of games evicted by limits:") > evicted, true);
+		read_from_device("/dev/mm", last_result, 4);
+		CHECK_IS_STRING_EQUAL(last_result, "????", 4);
+		write_to_device(max_games, "0", 1);
+	}
+#endif
+/** part 14 maps a long history across two pages and at a page offset */
+#ifdef TEST_PART_14
+	printf("Mapping a history longer than one page\n");
+	write_to_device("/dev/mm_ctl", "start", 5);
+	mm_fd = open("/dev/mm", O_RDWR);
+	for (int i = 0; i < 180; i++)
+		write(mm_fd, "1111", 4);
+	char *history = mmap(NULL, 2 * PAGE_SIZE, PROT_READ, MAP_SHARED, mm_fd, 0);
+	char *second = mmap(NULL, PAGE_SIZE, PROT_READ, MAP_SHARED, mm_fd, PAGE_SIZE);
+	CHECK_IS_NOT_EQUAL(history, MAP_FAILED);
+	CHECK_IS_NOT_EQUAL(second, MAP_FAILED);
+	if (history != MAP_FAILED && second != MAP_FAILED) {
+		char *line = history + 179 * USER_VIEW_LINE_SIZE;
+		CHECK_IS_STRING_EQUAL(line, "Guess 180: B2W0 | 1111", 22);
+		CHECK_IS_EQUAL(memcmp(history + PAGE_SIZE, second, PAGE_SIZE), 0);
+	}
+	munmap(history, 2 * PAGE_SIZE);
+	munmap(second, PAGE_SIZE);
+	close(mm_fd);
+#endif
+/** part 15 saves and restores all games through /dev/mm_snapshot (root only) */
+#ifdef TEST_PART_15
+	if (geteuid() == 0) {
+		printf("Saving and restoring a snapshot\n");
+		write_to_device("/dev/mm_ctl", "start", 5);
+		write_to_device("/dev/mm", "1111", 4);
+		size_t snapshot_size = 1 << 20;
+		char *snapshot = malloc(snapshot_size);
+		ssize_t snapshot_len = read_from_device("/dev/mm_snapshot", snapshot, snapshot_size);
+		CHECK_IS_EQUAL(snapshot_len >= (ssize_t)sizeof(struct mm_snapshot_header), true);
+		struct mm_snapshot_header header;
+		memcpy(&header, snapshot, sizeof(header));
+		CHECK_IS_EQUAL(header.magic, MM_SNAPSHOT_MAGIC);
+		write_to_device("/dev/mm_ctl", "quit", 4);
+		int snapshot_fd = open("/dev/mm_snapshot", O_WRONLY);
+		CHECK_IS_EQUAL(write(snapshot_fd, snapshot, snapshot_len), snapshot_len);
+		CHECK_IS_EQUAL(close(snapshot_fd), 0);
+		read_from_device("/dev/mm", last_result, 4);
+		CHECK_IS_STRING_EQUAL(last_result, "B2W0", 4);
+		snapshot_fd = open("/dev/mm_snapshot", O_WRONLY);
+		write(snapshot_fd, "garbage", 7);
+		CHECK_IS_EQUAL(close(snapshot_fd), -1);
+		free(snapshot);
+	}
+#endif
+/** part 16 plays through the binary ioctl interface and checks stricter text parsing */
+#ifdef TEST_PART_16
+	printf("Playing through ioctls\n");
+	int ctl_fd = open("/dev/mm_ctl", O_WRONLY);
+	struct mm_start start = { 0 };
+	CHECK_IS_EQUAL(ioctl(ctl_fd, MM_IOC_START, &start), 0);
+	mm_fd = open("/dev/mm", O_RDONLY);
+	struct mm_guess guess = { .guess = "1111" };
+	CHECK_IS_EQUAL(ioctl(mm_fd, MM_IOC_GUESS, &guess), 0);
+	CHECK_IS_EQUAL(guess.black, 2);
+	CHECK_IS_EQUAL(guess.white, 0);
+	memcpy(guess.guess, "4211", 4);
+	CHECK_IS_EQUAL(ioctl(mm_fd, MM_IOC_GUESS, &guess), 0);
+	CHECK_IS_EQUAL(guess.black, 4);
+	struct mm_state state;
+	CHECK_IS_EQUAL(ioctl(ctl_fd, MM_IOC_GET_STATE, &state), 0);
+	CHECK_IS_EQUAL(state.active, 0);
+	CHECK_IS_EQUAL(state.num_guesses, 2);
+	errno = 0;
+	CHECK_IS_EQUAL(ioctl(mm_fd, MM_IOC_GUESS, &guess), -1);
+	CHECK_IS_EQUAL(errno, EINVAL);
+	close(mm_fd);
+	close(ctl_fd);
+	CHECK_IS_EQUAL(write_to_device("/dev/mm_ctl", "s", 1), -1);
+	CHECK_IS_EQUAL(write_to_device("/dev/mm_ctl", "start\n", 6), 6);
+#endif
+/** part 17 checks that a descriptor reads back the result of its own guess */
+#ifdef TEST_PART_17
+	printf("Reading back the result of our own guess\n");
+	write_to_device("/dev/mm_ctl", "start", 5);
+	int player_a = open("/dev/mm", O_RDWR);
+	int player_b = open("/dev/mm", O_RDWR);
+	write(player_a, "1111", 4);
+	write(player_b, "4221", 4);
+	pread(player_a, last_result, 4, 0);
+	CHECK_IS_STRING_EQUAL(last_result, "B2W0", 4);
+	pread(player_b, last_result, 4, 0);
+	CHECK_IS_STRING_EQUAL(last_result, "B3W0", 4);
+	read_from_device("/dev/mm", last_result, 4);
+	CHECK_IS_STRING_EQUAL(last_result, "B3W0", 4);
+	close(player_a);
+	close(player_b);
+#endif
+/** part 18 sends several guesses and commands with one writev() each */
+#ifdef TEST_PART_18
+	printf("Playing with vectored writes\n");
+	struct iovec commands[] = {
+		{ .iov_base = "quit", .iov_len = 4 },
+		{ .iov_base = "start\n", .iov_len = 6 },
+	};
+	int ctl = open("/dev/mm_ctl", O_WRONLY);
+	CHECK_IS_EQUAL(writev(ctl, commands, 2), 10);
+	close(ctl);
+	struct iovec guesses[] = {
+		{ .iov_base = "1111", .iov_len = 4 },
+		{ .iov_base = "4221", .iov_len = 4 },
+		{ .iov_base = "4211", .iov_len = 4 },
+		{ .iov_base = "1111", .iov_len = 4 },
+	};
+	mm_fd = open("/dev/mm", O_RDWR);
+	CHECK_IS_EQUAL(writev(mm_fd, guesses, 4), 12);
+	CHECK_IS_EQUAL(ioctl(mm_fd, MM_IOC_GET_STATE, &state), 0);
+	CHECK_IS_EQUAL(state.num_guesses, 3);
+	CHECK_IS_EQUAL(state.active, 0);
+	close(mm_fd);
+#endif
+/** part 19 waits for the game to change with poll() and O_NONBLOCK reads */
+#ifdef TEST_PART_19
+	printf("Waiting for state changes\n");
+	write_to_device("/dev/mm_ctl", "start", 5);
+	mm_fd = open("/dev/mm", O_RDONLY | O_NONBLOCK);
+	CHECK_IS_EQUAL(read(mm_fd, last_result, 4), 4);
+	CHECK_IS_STRING_EQUAL(last_result, "B-W-", 4);
+	/* without MM_IOC_FOLLOW, the end of the result is end of file */
+	CHECK_IS_EQUAL(read(mm_fd, last_result, 4), 0);
+	__u32 follow = 1;
+	CHECK_IS_EQUAL(ioctl(mm_fd, MM_IOC_FOLLOW, &follow), 0);
+	CHECK_IS_EQUAL(read(mm_fd, last_result, 4), -1);
+	CHECK_IS_EQUAL(errno, EAGAIN);
+	struct pollfd pfd = { .fd = mm_fd, .events = POLLIN };
+	CHECK_IS_EQUAL(poll(&pfd, 1, 0), 0);
+	write_to_device("/dev/mm", "1111", 4);
+	CHECK_IS_EQUAL(poll(&pfd, 1, 0), 1);
+	CHECK_IS_EQUAL(pfd.revents & POLLIN, POLLIN);
+	CHECK_IS_EQUAL(read(mm_fd, last_result, 4), 4);
+	CHECK_IS_STRING_EQUAL(last_result, "B2W0", 4);
+	CHECK_IS_EQUAL(poll(&pfd, 1, 0), 0);
+	close(mm_fd);
+#endif
+/** part 20 makes guesses faster than guess_rate allows (root only) */
+#ifdef TEST_PART_20
+	if (geteuid() == 0) {
+		printf("Rate limiting guesses\n");
+		const char *rate = "/sys/module/mastermind2/parameters/guess_rate";
+		const char *burst = "/sys/module/mastermind2/parameters/guess_burst";
+		long throttled = read_stat("Number of guesses refused by rate limits:");
+		write_to_device("/dev/mm_ctl", "start", 5);
+		write_to_device(burst, "2", 1);
+		write_to_device(rate, "1", 1);
+		mm_fd = open("/dev/mm", O_RDWR);
+		CHECK_IS_EQUAL(write(mm_fd, "1111", 4), 4);
+		CHECK_IS_EQUAL(write(mm_fd, "2222", 4), 4);
+		CHECK_IS_EQUAL(write(mm_fd, "3333", 4), -1);
+		CHECK_IS_EQUAL(errno, EAGAIN);
+		CHECK_IS_EQUAL(read_stat("Number of guesses refused by rate limits:"), throttled + 1);
+		close(mm_fd);
+		write_to_device(rate, "0", 1);
+		write_to_device(burst, "16", 2);
+	}
+#endif
+/** part 21 sends two code changes in one TCP segment (root only) */
+#ifdef TEST_PART_21
+	if (geteuid() == 0) {
+		printf("Sending several code changes per segment\n");
+		const char *framing = "/sys/module/nf_cs421net/parameters/framing";
+		const char *changed = "Number of times code was changed:";
+		long codes = read_stat(changed);
+		write_to_device(framing, "1", 1);
+		cs421net_send("44424442", 8);
+		struct timespec frame_wait = { .tv_nsec = 10000000 };
+		for (int tries = 0; tries < 100 && read_stat(changed) < codes + 2; tries++)
+			nanosleep(&frame_wait, NULL);
+		CHECK_IS_EQUAL(read_stat(changed), codes + 2);
+		write_to_device(framing, "0", 1);
+	}
+#endif
+/** part 22 wins in one guess and looks for it on the leaderboard */
+#ifdef TEST_PART_22
+	printf("Checking the leaderboard\n");
+	write_to_device("/dev/mm_ctl", "start", 5);
+	write_to_device("/dev/mm", "4211", 4);
+	char board[PAGE_SIZE];
+	ssize_t board_len = read_from_device("/sys/devices/platform/mastermind/leaderboard",
+					     board, sizeof(board) - 1);
+	CHECK_IS_EQUAL(board_len > 0, true);
+	board[board_len > 0 ? board_len : 0] = '\0';
+	bool listed = false;
+	for (char *line = strchr(board, '\n'); line && line[1]; line = strchr(line + 1, '\n')) {
+		unsigned rank, uid, best;
+		if (sscanf(line + 1, "%u %u %u", &rank, &uid, &best) == 3 && uid == getuid())
+			listed = best == 1;
+	}
+	CHECK_IS_EQUAL(listed, true);
+#endif
+	/** part 23 changes the arena code to 4442 and joins the arena */
+#ifdef TEST_PART_23
+	printf("Checking arena mode\n");
+	int arena_sock = cs421net_connect();
+	CHECK_IS_EQUAL(arena_sock >= 0, true);
+	CHECK_IS_EQUAL(cs421net_send_fd(arena_sock, "4442", 4), true);
+	CHECK_IS_EQUAL(write_to_device("/dev/mm_ctl", "arena", 5), 5);
+	/* the code reaches the arena asynchronously, so rejoin until it has */
+	struct timespec arena_wait = { .tv_nsec = 10000000 };
+	for (int tries = 0; tries < 100; tries++) {
+		write_to_device("/dev/mm", "4442", 4);
+		read_from_device("/dev/mm", last_result, 4);
+		if (!memcmp(last_result, "B4W0", 4))
+			break;
+		nanosleep(&arena_wait, NULL);
+		write_to_device("/dev/mm_ctl", "arena", 5);
+	}
+	CHECK_IS_STRING_EQUAL(last_result, "B4W0", 4);
+	close(arena_sock);
+	write_to_device("/dev/mm_ctl", "start", 5);
+	write_to_device("/dev/mm", "4442", 4);
+	read_from_device("/dev/mm", last_result, 4);
+	CHECK_IS_STRING_EQUAL(last_result, "B1W1", 4);
+#endif
+	/** part 24 finds this user's game in the debugfs listing, read in small pieces (root only) */
+#ifdef TEST_PART_24
+	if (geteuid() == 0) {
+		printf("Listing all games\n");
+		write_to_device("/dev/mm_ctl", "start", 5);
+		write_to_device("/dev/mm", "1234", 4);
+		static char listing[1 << 20];
+		size_t listing_len = 0;
+		ssize_t got;
+		int games_fd = open("/sys/kernel/debug/mastermind/games", O_RDONLY);
+		CHECK_IS_EQUAL(games_fd >= 0, true);
+		while (games_fd >= 0 && listing_len < sizeof(listing) - 64 &&
+		       (got = read(games_fd, listing + listing_len, 64)) > 0)
+			listing_len += got;
+		close(games_fd);
+		listing[listing_len] = '\0';
+		CHECK_IS_EQUAL(strncmp(listing, "uid kind active", 15), 0);
+		bool found = false;
+		for (char *line = strchr(listing, '\n'); line && line[1]; line = strchr(line + 1, '\n')) {
+			unsigned uid, guesses;
+			char kind[8], result[5];
+			int active, colors;
+			if (sscanf(line + 1, "%u %7s %d %d %u %4s", &uid, kind, &active, &colors,
+				   &guesses, result) == 6 && uid == getuid() && !strcmp(kind, "user"))
+				found = active == 1 && guesses == 1 && !strcmp(result, "B1W2");
+		}
+		CHECK_IS_EQUAL(found, true);
+	}
+#endif
+	/** part 25 runs a short in-kernel self-benchmark (root only) */
+#ifdef TEST_PART_25
+	if (geteuid() == 0) {
+		printf("Running the self-benchmark\n");
+		const char *bench = "/sys/kernel/debug/mastermind/bench";
+		CHECK_IS_EQUAL(write_to_device(bench, "2 100 1", 7), 7);
+		CHECK_IS_EQUAL(write_to_device(bench, "0 100", 5), -1);
+		char report[PAGE_SIZE];
+		ssize_t report_len = read_from_device(bench, report, sizeof(report) - 1);
+		report[report_len > 0 ? report_len : 0] = '\0';
+		unsigned long long guesses = 0, per_second = 0;
+		char *line = strstr(report, "\nguesses ");
+		if (line)
+			sscanf(line, "\nguesses %llu, %llu per second", &guesses, &per_second);
+		CHECK_IS_EQUAL(guesses > 0 && per_second > 0, true);
+		CHECK_IS_EQUAL(strstr(report, "device_data_lock contended") != NULL, true);
+	}
+#endif
+	/** part 26 finds random codes by trying every code, and repeats them with a seed (root only) */
+#ifdef TEST_PART_26
+	if (geteuid() == 0) {
+		printf("Checking random codes\n");
+		const char *random_codes = "/sys/module/mastermind2/parameters/random_codes";
+		const char *code_seed = "/sys/module/mastermind2/parameters/code_seed";
+		char *seeds[] = { "7", "8", "7" };
+		int found[3];
+		write_to_device(random_codes, "1", 1);
+		mm_fd = open("/dev/mm", O_RDWR);
+		for (int run = 0; run < 3; run++) {
+			write_to_device(code_seed, seeds[run], 1);
+			write_to_device("/dev/mm_ctl", "start", 5);
+			found[run] = -1;
+			for (int code = 0; code < 6 * 6 * 6 * 6 && found[run] < 0; code++) {
+				char guess[4] = { '0' + code / 216, '0' + code / 36 % 6,
+						  '0' + code / 6 % 6, '0' + code % 6 };
+				write(mm_fd, guess, 4);
+				if (pread(mm_fd, last_result, 4, 0) == 4 && last_result[1] == '4')
+					found[run] = code;
+			}
+		}
+		close(mm_fd);
+		write_to_device(code_seed, "0", 1);
+		write_to_device(random_codes, "0", 1);
+		CHECK_IS_EQUAL(found[0] >= 0 && found[1] >= 0, true);
+		CHECK_IS_EQUAL(found[0], found[2]);
+	}
+#endif
+	/** part 27 reads a result in two pieces, then the whole history in one read */
+#ifdef TEST_PART_27
+	printf("Reading the history\n");
+	write_to_device("/dev/mm_ctl", "start", 5);
+	write_to_device("/dev/mm", "1234", 4);
+	mm_fd = open("/dev/mm", O_RDONLY);
+	CHECK_IS_EQUAL(read(mm_fd, last_result, 2), 2);
+	CHECK_IS_EQUAL(read(mm_fd, last_result + 2, 2), 2);
+	CHECK_IS_STRING_EQUAL(last_result, "B1W2", 4);
+	CHECK_IS_EQUAL(read(mm_fd, last_result, 4), 0);
+	close(mm_fd);
+	write_to_device("/dev/mm", "4211", 4);
+	char history_text[4096];
+	int history_fd = open("/dev/mm_history", O_RDONLY);
+	CHECK_IS_EQUAL(read(history_fd, history_text, sizeof(history_text)), 3 * 24);
+	CHECK_IS_STRING_EQUAL(history_text, "Guess 1: B1W2 | 1234\n", 21);
+	char *won_line = history_text + 2 * 24;
+	CHECK_IS_STRING_EQUAL(won_line, "You won, game over!\n", 20);
+	CHECK_IS_EQUAL(read(history_fd, history_text, sizeof(history_text)), 0);
+	CHECK_IS_EQUAL(pread(history_fd, history_text, 24, 24), 24);
+	CHECK_IS_STRING_EQUAL(history_text, "Guess 2: B4W0 | 4211\n", 21);
+	close(history_fd);
 #endif
 	report_test_results();
 	return 0;
@@ -17,31 +17,154 @@
 
 #define pr_fmt(fmt) "mastermind2: " fmt
 
+#include <linux/bsearch.h>
 #include <linux/capability.h>
+#include <linux/completion.h>
+#include <linux/cpumask.h>
 #include <linux/cred.h>
+#include <linux/debugfs.h>
+#include <linux/delay.h>
+#include <linux/firmware.h>
 #include <linux/fs.h>
 #include <linux/gfp.h>
+#include <linux/hashtable.h>
 #include <linux/init.h>
 #include <linux/interrupt.h>
+#include <linux/jiffies.h>
+#include <linux/ktime.h>
+#include <linux/kref.h>
+#include <linux/kthread.h>
 #include <linux/list.h>
 #include <linux/miscdevice.h>
 #include <linux/mm.h>
+#include <linux/math64.h>
 #include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/mutex.h>
+#include <linux/percpu.h>
 #include <linux/platform_device.h>
+#include <linux/poll.h>
+#include <linux/random.h>
+#include <linux/rbtree.h>
+#include <linux/rcupdate.h>
 #include <linux/sched.h>
+#include <linux/seq_file.h>
 #include <linux/slab.h>
+#include <linux/sort.h>
 #include <linux/spinlock.h>
 #include <linux/uaccess.h>
 #include <linux/uidgid.h>
+#include <linux/uio.h>
 #include <linux/vmalloc.h>
+#include <linux/wait.h>
+#include <linux/workqueue.h>
 
+#include <asm/unaligned.h>
+
+#include "mastermind2.h"
 #include "nf_cs421net.h"
 
-#define NUM_PEGS 4
-#define USER_VIEW_LINE_SIZE 22
+#define NUM_PEGS MM_NUM_PEGS
+#define USER_VIEW_LINE_SIZE 24
+
+/** number of guesses per game kept in binary form for the solver */
+#define MM_HISTORY_MAX 256
+
+/** pages needed to render every recorded guess plus the winning line */
+#define MM_USER_VIEW_PAGES \
+	DIV_ROUND_UP((MM_HISTORY_MAX + 1) * USER_VIEW_LINE_SIZE, PAGE_SIZE)
+
+/** longest /dev/mm_ctl command, including a trailing newline, plus one */
+#define MM_CTL_COMMAND_MAX 16
+
+/** guesses scored per lock hold by a vectored write to /dev/mm */
+#define MM_GUESS_BATCH 64
+
+/** candidate count at or below which MM_IOC_SOLVE runs a minimax search */
+#define MM_SOLVE_MINIMAX_MAX 256
+
+/** largest board (in codes) that gets a shared score table */
+#define MM_SCORE_TABLE_MAX_SPACE 4096
 
 static int NUM_COLORS = 6;
 
+static bool track_candidates;
+module_param(track_candidates, bool, 0644);
+MODULE_PARM_DESC(track_candidates,
+		 "Narrow each new game's candidate set after every guess (default: on first MM_IOC_SOLVE)");
+
+static bool random_codes;
+module_param(random_codes, bool, 0644);
+MODULE_PARM_DESC(random_codes, "Give every new game a random code instead of 4211 (default: off)");
+
+static unsigned long code_seed;
+module_param(code_seed, ulong, 0644);
+MODULE_PARM_DESC(code_seed,
+		 "If nonzero, draw random codes from a generator seeded with this, so that runs repeat");
+
+static bool score_tables = true;
+module_param(score_tables, bool, 0644);
+MODULE_PARM_DESC(score_tables, "Score guesses from a shared precomputed table (default: on)");
+
+static bool per_file_games;
+module_param(per_file_games, bool, 0644);
+MODULE_PARM_DESC(per_file_games,
+		 "Give every open of /dev/mm its own game instead of one game per user (default: off)");
+
+static unsigned idle_timeout = 3600;
+module_param(idle_timeout, uint, 0644);
+MODULE_PARM_DESC(idle_timeout, "Seconds before an untouched game in progress is freed, 0 to keep (default: 3600)");
+
+static unsigned finished_timeout = 300;
+module_param(finished_timeout, uint, 0644);
+MODULE_PARM_DESC(finished_timeout, "Seconds before an untouched won or quit game is freed, 0 to keep (default: 300)");
+
+static unsigned max_games;
+module_param(max_games, uint, 0644);
+MODULE_PARM_DESC(max_games, "Most per-user games kept at once, evicting the least recently used, 0 for no limit");
+
+static unsigned max_history_pages;
+module_param(max_history_pages, uint, 0644);
+MODULE_PARM_DESC(max_history_pages, "Most history and candidate pages kept at once, 0 for no limit");
+
+static unsigned guess_rate;
+module_param(guess_rate, uint, 0644);
+MODULE_PARM_DESC(guess_rate, "Guesses per second each user may make on average, 0 for no limit");
+
+static unsigned guess_burst = 16;
+module_param(guess_burst, uint, 0644);
+MODULE_PARM_DESC(guess_burst, "Guesses a user may make at once before guess_rate applies (default: 16)");
+
+static unsigned leaderboard_size = 10;
+module_param(leaderboard_size, uint, 0644);
+MODULE_PARM_DESC(leaderboard_size, "Number of players listed in the leaderboard file (default: 10)");
+
+static bool net_irq;
+module_param(net_irq, bool, 0444);
+MODULE_PARM_DESC(net_irq, "Receive code changes through the CS421Net interrupt rather than a direct callback");
+
+static char *restore_snapshot;
+module_param(restore_snapshot, charp, 0444);
+MODULE_PARM_DESC(restore_snapshot, "Firmware file holding a /dev/mm_snapshot image to restore at load");
+
+/** largest snapshot accepted by writes to /dev/mm_snapshot */
+#define MM_SNAPSHOT_MAX (64 << 20)
+
+/** how often idle games are looked for */
+#define MM_RECLAIM_INTERVAL (10 * HZ)
+
+/** how long a game in progress must be untouched before the shrinker drops its user view */
+#define MM_SHRINK_IDLE (60 * HZ)
+
+/** games a fan-out worker gives a network code per hold of device_data_lock */
+#define MM_FANOUT_BATCH 64
+
+/** most player kthreads of one self-benchmark */
+#define MM_BENCH_MAX_THREADS 256
+
+/** longest self-benchmark, in milliseconds */
+#define MM_BENCH_MAX_MS 60000
+
 /** number of games currently active */
 static int games_active = 0;
 
@@ -54,17 +177,175 @@ static int codes_changed = 0;
 /** number of times there was an invalid attempt to change colors */
 static int invalid_attempts = 0;
 
+/** number of games on game_list */
+static unsigned games_allocated;
+
+/** number of user view and candidate pages allocated */
+static atomic_t history_pages = ATOMIC_INIT(0);
+
+/** number of games freed for being idle */
+static unsigned long games_reclaimed;
+
+/** number of games freed to stay within max_games or max_history_pages */
+static unsigned long games_evicted;
+
+/** number of user view pages freed by the shrinker */
+static unsigned long views_shrunk;
+
+/** number of guesses refused for exceeding guess_rate */
+static atomic_long_t guesses_throttled = ATOMIC_LONG_INIT(0);
+
+/** source of mm_game.start_seq */
+static u64 games_start_seq;
+
+/** latest valid code from the network, under device_data_lock */
+static int fanout_code[NUM_PEGS];
+
+/** number of valid codes from the network, under device_data_lock */
+static unsigned long fanout_seq;
+
+/** fanout_seq of the last code every game has been given */
+static unsigned long fanout_done_seq;
+
+/** whether mm_net_consume() is registered with CS421Net */
+static bool net_consumer;
+
+/**
+ * struct mm_shard - the games allocated on one CPU
+ * @lock: protects @games; taken before device_data_lock
+ * @games: every game allocated on the shard's CPU, by mm_game.shard_node
+ */
+struct mm_shard {
+	spinlock_t lock;
+	struct list_head games;
+};
+
+static DEFINE_PER_CPU(struct mm_shard, mm_shards);
+
+/**
+ * struct mm_guess_record - one scored guess, in binary form
+ * @guess: guess as written by the user (ASCII, not validated)
+ * @black: number of black pegs it scored
+ * @white: number of white pegs it scored
+ */
+struct mm_guess_record {
+	char guess[NUM_PEGS];
+	u8 black;
+	u8 white;
+};
+
+/**
+ * struct mm_score_table - MM_SCORE() of every (guess, code) pair of one
+ * board configuration, shared read-only by all games on that board
+ * @ref: one reference per game or mapping using the table, plus one
+ * while it is the published table for @colors
+ * @colors: number of colors on the board
+ * @space: number of codes on the board
+ * @scores: @space rows of @space bytes, row = guess, plus 64 bytes of
+ * padding so that whole words can be loaded from the last row
+ */
+struct mm_score_table {
+	struct kref ref;
+	int colors;
+	unsigned space;
+	u8 *scores;
+};
+
+/*
+ * Fields are grouped by how they are written, one group per cache line
+ * or more, so that a guess does not invalidate the lines other CPUs
+ * read to score theirs, nor games coming and going next to this one
+ * those the guess path uses.
+ */
 struct mm_game
 {
-	struct list_head list;
+	/* read-mostly: written when the game is created, started or given a code */
+
 	kuid_t uid;
+	/* NUMA node the game and its history were allocated on */
+	int node;
+	/* owned by one open file of /dev/mm rather than shared by @uid */
+	bool per_file;
+	/* per-user game that mm_lookup_game() can still find */
+	bool registered;
 	bool game_active;
+	/* scored against arena_code rather than target_code */
+	bool arena;
+	/* seq of the newest arena code this game's history has seen */
+	u64 arena_seq;
+	bool track_candidates;
+	/* self-benchmark game, kept out of stats, leaderboard and fan-out */
+	bool bench;
+	int colors;
 	int target_code[NUM_PEGS];
+	/* index of target_code on the board, or -1 if it has out-of-range pegs */
+	int target_index;
+	struct mm_score_table *scores;
+	/* distinct for every start of every game */
+	u64 start_seq;
+	/* fanout_seq when this game last got a network code or was started */
+	unsigned long code_seq;
+	/* shard listing this game */
+	struct mm_shard *shard;
+	struct mm_guess_record *history;
+	/* codes consistent with history[0..candidates_applied), NULL until needed */
+	struct mm_candidate_view *candidate_view;
+	/* rendering of history; each page is NULL until faulted in or after being shrunk */
+	struct page *user_view[MM_USER_VIEW_PAGES];
+
+	/* written by every guess, and by every lookup */
+
+	/* one reference for game_list or the owning file, one per user */
+	struct kref ref ____cacheline_aligned_in_smp;
+	unsigned long last_used;
+	/* on game_list in least recently used order */
+	struct list_head list;
+	/* bumped whenever what a read of /dev/mm returns may have changed */
+	unsigned long state_seq;
 	unsigned num_guesses;
 	char last_result[4];
-	char *user_view;
+	unsigned history_len;
+	/* bytes of history rendered so far, whether or not their pages exist */
 	size_t user_view_size;
-	loff_t user_view_pointer;
+	unsigned candidates_applied;
+	bool candidates_stale;
+
+	/* written when other games or files come and go */
+
+	/* entry on shard's games */
+	struct list_head shard_node ____cacheline_aligned_in_smp;
+	/* struct mm_file of every open /dev/mm remembering this game */
+	struct list_head watchers;
+	/* number of mappings of user_view; the shrinker skips mapped views */
+	unsigned user_view_maps;
+};
+
+/* struct mm_game objects, each starting on a cache line */
+static struct kmem_cache *mm_game_cache;
+
+/**
+ * struct mm_file - state of an open /dev/mm
+ * @game: game owned by the file if per_file_games was set when it was
+ * opened, otherwise the last per-user game it used, or %NULL
+ * @result_seq: start_seq of @game when this file last wrote a guess,
+ * 0 if it never did
+ * @last_result: result of that guess
+ * @watch: entry on @game's watchers while @game is set
+ * @seen_seq: state_seq of @game when this file last read a whole result
+ * @waitq: readers and pollers waiting for @game to change
+ * @follow: reads past the result wait for @game to change rather than
+ * return 0, set with MM_IOC_FOLLOW
+ *
+ * Protected by device_data_lock.
+ */
+struct mm_file {
+	struct mm_game *game;
+	u64 result_seq;
+	char last_result[NUM_PEGS];
+	struct list_head watch;
+	unsigned long seen_seq;
+	wait_queue_head_t waitq;
+	bool follow;
 };
 
 struct list_head game_list;
@@ -72,55 +353,6 @@ LIST_HEAD(game_list);
 
 DEFINE_SPINLOCK(device_data_lock);
 
-/**
- * initialize_game() - initializes all required variables for the game
- * */
-static void initialize_game(struct mm_game * game)
-{
-	size_t i;
-	game->target_code[0] = 4;
-	game->target_code[1] = 2;
-	game->target_code[2] = 1;
-	game->target_code[3] = 1;
-	game->num_guesses = 0;
-	for (i = 0; i < 4096; i++)
-	{
-		game->user_view[i] = 0;
-	}
-	game->user_view_pointer = 0;
-	game->user_view_size = 0;
-	game->game_active = true;
-	games_started++;
-	games_active++;
-	game->last_result[0] = 'B';
-	game->last_result[1] = '-';
-	game->last_result[2] = 'W';
-	game->last_result[3] = '-';
-}
-
-static struct mm_game *mm_find_game(kuid_t uid){
-	struct list_head *ptr;
-	struct mm_game * game, * new ;
-	for (ptr = game_list.next; ptr!=&game_list; ptr = ptr->next){
-		game = list_entry (ptr, struct mm_game, list);
-		if (uid_eq(game->uid, uid)){
-			return game;
-		} 
-	}
-	new = (struct mm_game *) kzalloc(sizeof(struct mm_game), GFP_KERNEL);
-	new->uid = uid;
-	spin_lock(&device_data_lock);
-	new->user_view = vmalloc(PAGE_SIZE);
-	if (!new->user_view)
-	{
-		pr_err("Could not allocate memory\n");
-		spin_unlock(&device_data_lock);
-		return (void *) -ENOMEM;
-	}
-	list_add_tail(&new->list, game_list.next);
-	spin_unlock(&device_data_lock);
-	return new;
-}
 /**
  * mm_num_pegs() - calculate number of black pegs and number of white pegs
  * @target: target code, up to NUM_PEGS elements
@@ -165,266 +397,2734 @@ static void mm_num_pegs(int target[], int guess[], unsigned *num_black,
 	}
 }
 
-/* Copy mm_read(), mm_write(), mm_mmap(), and mm_ctl_write(), along
- * with all of your global variables and helper functions here.
+/**
+ * mm_code_space() - number of distinct codes for a board
+ * @colors: number of colors on the board
+ *
+ * Return: @colors raised to NUM_PEGS
  */
-/* Part 1: YOUR CODE HERE */
+static unsigned mm_code_space(int colors)
+{
+	unsigned space = 1;
+	size_t i;
+
+	for (i = 0; i < NUM_PEGS; i++)
+		space *= colors;
+	return space;
+}
 
 /**
- * compare_strings() - takes in two char strings along with their sizes and checks if both strings
- * are equal or not 
- * @source_string: source string to compare
- * @source_size: size of source string
- * @dest_stirng: destination string
- * @dest_size: size of destination string
- * */
-static bool compare_strings(const char *source_string, size_t source_size, const char *dest_string, size_t dest_size)
+ * mm_index_to_code() - convert a code index into peg values
+ * @index: index in [0, mm_code_space(@colors))
+ * @colors: number of colors on the board
+ * @code: *OUT* parameter, NUM_PEGS peg values
+ *
+ * The first peg is the most significant digit of @index.
+ */
+static void mm_index_to_code(unsigned index, int colors, int code[])
 {
-	bool areEqual = true;
 	size_t i;
-	size_t j;
-	for (i = 0, j = 0; i < source_size && j < dest_size; i++, j++)
-	{
-		if (source_string[i] != dest_string[j])
-		{
-			areEqual = false;
-			break;
-		}
+
+	for (i = NUM_PEGS; i > 0; i--) {
+		code[i - 1] = index % colors;
+		index /= colors;
 	}
-	return areEqual;
 }
 
+/* generator of random codes while code_seed is set, under device_data_lock */
+static struct rnd_state code_rnd;
+/* code_seed that code_rnd was last seeded with */
+static unsigned long code_rnd_seed;
+
 /**
- * mm_read() - callback invoked when a process reads from
- * /dev/mm
- * @filp: process's file object that is reading from this device (ignored)
- * @ubuf: destination buffer to store output
- * @count: number of bytes in @ubuf
- * @ppos: file offset (in/out parameter)
- *
- * Write to @ubuf the last result of the game, offset by
- * @ppos. Copy the lesser of @count and (string length of @last_result
- * - *@ppos). Then increment the value pointed to by @ppos by the
- * number of bytes copied. If @ppos is greater than or equal to the
- * length of @last_result, then copy nothing.
+ * mm_random_code() - choose the code of a new game
+ * @colors: number of colors on the board
+ * @code: *OUT* parameter, NUM_PEGS peg values
  *
- * If no game is active, instead copy to @ubuf up to four '?'
- * characters.
+ * A single 32-bit draw picks the whole code. Without code_seed, it comes
+ * from get_random_u32(), which serves it from a per-CPU batch of
+ * entropy, so that frequent restarts stay cheap. Setting code_seed to a
+ * new value restarts a deterministic sequence of codes instead.
  *
- * Return: number of bytes written to @ubuf, or negative on error
+ * Caller must hold device_data_lock.
  */
-static ssize_t mm_read(struct file *filp, char __user *ubuf, size_t count,
-					   loff_t *ppos)
+static void mm_random_code(int colors, int code[])
 {
-	int copy_result;
-	struct mm_game *game;
-	size_t bytes_to_copy;
-	bytes_to_copy = 4 - *ppos;
-	game = mm_find_game(current_cred()->uid);
-	if (bytes_to_copy > count && count > 0)
-	{
-		bytes_to_copy = count;
-	}
-	if (*ppos >= 4)
-	{
-		return -1;
-	}
-	else
-	{
-		spin_lock(&device_data_lock);
-		copy_result = 0;
-		if (game->game_active)
-		{
-			copy_result = copy_to_user(ubuf + *ppos, game->last_result, bytes_to_copy);
-		}
-		else
-		{
-			copy_result = copy_to_user(ubuf + *ppos, "????", bytes_to_copy);
-		}
-		if (copy_result != 0)
-		{
-			spin_unlock(&device_data_lock);
-			return -1;
+	unsigned long seed = READ_ONCE(code_seed);
+	u32 r;
+
+	if (seed) {
+		if (seed != code_rnd_seed) {
+			prandom_seed_state(&code_rnd, seed);
+			code_rnd_seed = seed;
 		}
-		*ppos += bytes_to_copy;
-		spin_unlock(&device_data_lock);
-		return bytes_to_copy;
+		r = prandom_u32_state(&code_rnd);
+	} else {
+		r = get_random_u32();
+		code_rnd_seed = 0;
 	}
+	mm_index_to_code(reciprocal_scale(r, mm_code_space(colors)), colors, code);
 }
+
 /**
- * convert_number_to_array() - takes in a number, converts it into a string and stores the result in 
- * the result array provided in the arguments
- * @number: number to be converted
- * @result: destination array to store the converted string in
- * 
- * Return: size of the string
- * */
-static size_t convert_number_to_array(int number, char **result)
+ * mm_code_to_index() - convert peg values into a code index
+ * @code: NUM_PEGS peg values
+ * @colors: number of colors on the board
+ *
+ * Return: index in [0, mm_code_space(@colors)), or -1 if a peg is not
+ * a valid color
+ */
+static int mm_code_to_index(const int code[], int colors)
 {
-	int remainder;
-	int digit;
+	int index = 0;
 	size_t i;
-	size_t array_size = 0;
-	remainder = number;
-	while (remainder > 0)
-	{
-		remainder = remainder / 10;
-		array_size++;
-	}
-	if(array_size == 0) array_size = 1;
-	*result = vmalloc(array_size);
-	remainder = number;
-	for (i = 0; i < array_size; i++)
-	{
-		digit = remainder % 10;
-		*result[i] = '0' + digit;
-		remainder = remainder / 10;
+
+	for (i = 0; i < NUM_PEGS; i++) {
+		if (code[i] < 0 || code[i] >= colors)
+			return -1;
+		index = index * colors + code[i];
 	}
-	return array_size;
+	return index;
 }
-/**
- * write_last_result_to_user_view() - takes a characte arrays consisting of user's last guess and
- * writes the result to user view array
- * @user_guess: user's guess
- * */
-static void write_last_result_to_user_view(char *user_guess, struct mm_game * game)
-{
 
-	char result_to_write[USER_VIEW_LINE_SIZE];
-	char *guess_number_char_array;
-	size_t guess_array_size;
-	size_t i;
-	loff_t current_result_buffer_pointer;
-	current_result_buffer_pointer = 0;
-	for (i = 0; i < USER_VIEW_LINE_SIZE; i++)
-	{
-		result_to_write[i] = 0;
-	}
-	current_result_buffer_pointer += scnprintf(result_to_write, 7, "Guess ");
-	guess_array_size = convert_number_to_array(game->num_guesses, &guess_number_char_array);
+/* published score table per number of colors, under device_data_lock */
+static struct mm_score_table *score_table_slots[MM_MAX_COLORS + 1];
 
-	current_result_buffer_pointer += scnprintf(result_to_write + current_result_buffer_pointer, guess_array_size + 1, guess_number_char_array);
-	current_result_buffer_pointer += scnprintf(result_to_write + current_result_buffer_pointer, 3, ": ");
-	current_result_buffer_pointer += scnprintf(result_to_write + current_result_buffer_pointer, 5, game->last_result);
-	current_result_buffer_pointer += scnprintf(result_to_write + current_result_buffer_pointer, 4, " | ");
-	current_result_buffer_pointer += scnprintf(result_to_write + current_result_buffer_pointer, NUM_PEGS + 1, user_guess);
-	current_result_buffer_pointer += scnprintf(result_to_write + current_result_buffer_pointer, 2, "\n");
-	strcpy(game->user_view + game->user_view_pointer, result_to_write);
-	game->user_view_pointer += USER_VIEW_LINE_SIZE;
-	game->user_view_size += USER_VIEW_LINE_SIZE;
+/* bit n set: a table for n colors has been asked for */
+static unsigned long score_tables_wanted;
+
+static void mm_score_table_release(struct kref *ref)
+{
+	struct mm_score_table *table = container_of(ref, struct mm_score_table, ref);
+
+	/* the last reference may be dropped under device_data_lock */
+	vfree_atomic(table->scores);
+	kfree(table);
 }
 
-static void write_success_message_to_user_view(struct mm_game * game){
-	char result_to_write[USER_VIEW_LINE_SIZE];
-	loff_t current_result_buffer_pointer;
-	current_result_buffer_pointer = 0;
-	current_result_buffer_pointer += scnprintf(result_to_write, 20, "You won, game over!");
-	current_result_buffer_pointer += scnprintf(result_to_write + current_result_buffer_pointer, 2, "\n");
-	strcpy(game->user_view + game->user_view_pointer, result_to_write);
-	game->user_view_pointer += USER_VIEW_LINE_SIZE;
-	game->user_view_size += USER_VIEW_LINE_SIZE;
+static void mm_score_table_put(struct mm_score_table *table)
+{
+	if (table)
+		kref_put(&table->ref, mm_score_table_release);
 }
 
 /**
- * mm_write() - callback invoked when a process writes to /dev/mm
- * @filp: process's file object that is reading from this device (ignored)
- * @ubuf: source buffer from user
- * @count: number of bytes in @ubuf
- * @ppos: file offset (ignored)
- *
- * If the user is not currently playing a game, then return -EINVAL.
- *
- * If @count is less than NUM_PEGS, then return -EINVAL. Otherwise,
- * interpret the first NUM_PEGS characters in @ubuf as the user's
- * guess. Calculate how many are in the correct value and position,
- * and how many are simply the correct value. Then update
- * @num_guesses, @last_result, and @user_view.
+ * mm_score_table_build() - allocate and fill the table for @colors
+ * @colors: number of colors on the board
  *
- * <em>Caution: @ubuf is NOT a string; it is not necessarily
- * null-terminated.</em> You CANNOT use strcpy() or strlen() on it!
- *
- * Return: @count, or negative on error
+ * Return: table holding one reference, or %NULL
  */
-static ssize_t
-mm_write(struct file *filp, const char __user *ubuf,
-		 size_t count, loff_t *ppos)
+static struct mm_score_table *mm_score_table_build(int colors)
 {
-	struct mm_game * game = mm_find_game(current_cred()->uid);
-	int correct_place_guesses; 
-	int correct_value_guesses; 
-	char temp_array[NUM_PEGS];
-	int user_guess[NUM_PEGS];
-	int user_data_size;
-	size_t i;
-	correct_place_guesses = 0;
-	correct_value_guesses = 0;
-	for ( i = 0; i < NUM_PEGS; i++)
-	{
-		temp_array[i] = 0;
-		user_guess[i] = 0;
+	struct mm_score_table *table;
+	unsigned space = mm_code_space(colors);
+	int guess[NUM_PEGS], code[NUM_PEGS];
+	unsigned black, white;
+	unsigned g, c;
+	u8 *row;
+
+	table = kzalloc(sizeof(*table), GFP_KERNEL);
+	if (!table)
+		return NULL;
+	table->scores = vmalloc_user((size_t)space * space + 64);
+	if (!table->scores) {
+		kfree(table);
+		return NULL;
 	}
-	
-	if (game->game_active)
-	{
-		if (count < NUM_PEGS)
-		{
-			return -EINVAL;
-		}
-		else
-		{
-			user_data_size = copy_from_user(temp_array, ubuf, NUM_PEGS);
-			spin_lock(&device_data_lock);
-			for (i = 0; i < NUM_PEGS; i++)
-			{
-				user_guess[i] = temp_array[i] - '0';
-			}
-			mm_num_pegs(game->target_code, user_guess, &correct_place_guesses, &correct_value_guesses);
-			game->last_result[1] = '0' + correct_place_guesses;
-			game->last_result[3] = '0' + correct_value_guesses;
-			game->num_guesses++;
-			write_last_result_to_user_view(temp_array, game);
-			if(correct_place_guesses == 4){
-				write_success_message_to_user_view(game);
-				game->game_active = false;
-			}
-			spin_unlock(&device_data_lock);
-			return count;
+	kref_init(&table->ref);
+	table->colors = colors;
+	table->space = space;
+	for (g = 0; g < space; g++) {
+		mm_index_to_code(g, colors, guess);
+		row = table->scores + (size_t)g * space;
+		for (c = 0; c < space; c++) {
+			mm_index_to_code(c, colors, code);
+			mm_num_pegs(code, guess, &black, &white);
+			row[c] = MM_SCORE(black, white);
 		}
+		cond_resched();
 	}
-	else
-	{
-		return -EINVAL;
+	return table;
+}
+
+/**
+ * mm_score_table_work_func() - build every requested score table
+ *
+ * Runs on the system workqueue so that neither "start" nor
+ * "colors N" waits for a multi-megabyte table.
+ */
+static void mm_score_table_work_func(struct work_struct *work)
+{
+	struct mm_score_table *table;
+	int colors;
+
+	for (colors = 2; colors <= MM_MAX_COLORS; colors++) {
+		if (!test_and_clear_bit(colors, &score_tables_wanted))
+			continue;
+		table = mm_score_table_build(colors);
+		if (!table) {
+			pr_warn("Could not allocate score table for %d colors\n", colors);
+			continue;
+		}
+		spin_lock(&device_data_lock);
+		if (!score_table_slots[colors]) {
+			score_table_slots[colors] = table;
+			table = NULL;
+		}
+		spin_unlock(&device_data_lock);
+		mm_score_table_put(table);
 	}
 }
 
+static DECLARE_WORK(score_table_work, mm_score_table_work_func);
+
 /**
- * mm_mmap() - callback invoked when a process mmap()s to /dev/mm
- * @filp: process's file object that is mapping to this device (ignored)
- * @vma: virtual memory allocation object containing mmap() request
+ * mm_score_table_request() - build the table for @colors in the
+ * background unless it is already published or too large
+ * @colors: number of colors on the board
  *
- * Create a read-only mapping from kernel memory (specifically,
- * @user_view) into user space.
+ * Caller must hold device_data_lock.
+ */
+static void mm_score_table_request(int colors)
+{
+	if (!score_tables || mm_code_space(colors) > MM_SCORE_TABLE_MAX_SPACE)
+		return;
+	if (score_table_slots[colors])
+		return;
+	if (!test_and_set_bit(colors, &score_tables_wanted))
+		schedule_work(&score_table_work);
+}
+
+/**
+ * mm_score_table_get() - take a reference on the table for @colors
+ * @colors: number of colors on the board
  *
- * Code based upon
- * <a href="http://bloggar.combitech.se/ldc/2015/01/21/mmap-memory-between-kernel-and-userspace/">http://bloggar.combitech.se/ldc/2015/01/21/mmap-memory-between-kernel-and-userspace/</a>
+ * If no table is published yet, ask for one to be built; callers
+ * score directly until then.
  *
- * You do not need to modify this function.
+ * Caller must hold device_data_lock.
  *
- * Return: 0 on success, negative on error.
+ * Return: referenced table, or %NULL
  */
-static int mm_mmap(struct file *filp, struct vm_area_struct *vma)
+static struct mm_score_table *mm_score_table_get(int colors)
 {
+	struct mm_score_table *table = score_table_slots[colors];
 
-	struct mm_game * game = mm_find_game(current_cred()->uid);
-	unsigned long size = (unsigned long)(vma->vm_end - vma->vm_start);
-	unsigned long page = vmalloc_to_pfn(game->user_view);
-	if (size > PAGE_SIZE)
-		return -EIO;
-	vma->vm_pgoff = 0;
-	vma->vm_page_prot = PAGE_READONLY;
-	if (remap_pfn_range(vma, vma->vm_start, page, size, vma->vm_page_prot))
-		return -EAGAIN;
-	return 0;
+	if (!score_tables || !table) {
+		mm_score_table_request(colors);
+		return NULL;
+	}
+	kref_get(&table->ref);
+	return table;
+}
+
+/**
+ * mm_score_table_unpublish() - stop handing out the table for @colors
+ * @colors: number of colors on the board
+ *
+ * Games already holding the table keep it until they restart.
+ *
+ * Caller must hold device_data_lock.
+ */
+static void mm_score_table_unpublish(int colors)
+{
+	mm_score_table_put(score_table_slots[colors]);
+	score_table_slots[colors] = NULL;
+}
+
+/**
+ * mm_score_table_reclaim() - unpublish every table that no game or
+ * mapping uses, except that of the current number of colors
+ *
+ * A table is only taken while published, under device_data_lock, so
+ * one held by its slot alone stays unused until unpublished.
+ *
+ * Caller must hold device_data_lock.
+ */
+static void mm_score_table_reclaim(void)
+{
+	int colors;
+
+	for (colors = 2; colors <= MM_MAX_COLORS; colors++) {
+		if (colors != NUM_COLORS && score_table_slots[colors] &&
+		    kref_read(&score_table_slots[colors]->ref) == 1)
+			mm_score_table_unpublish(colors);
+	}
+}
+
+/**
+ * struct mm_arena_code - target shared by every game in the arena
+ * @code: peg values
+ * @colors: number of colors the code was chosen from
+ * @index: index of @code on a board of @colors colors
+ * @seq: distinct and increasing for every published code, never 0
+ * @rcu: for freeing once no scorer can still see the code
+ */
+struct mm_arena_code {
+	int code[NUM_PEGS];
+	int colors;
+	int index;
+	u64 seq;
+	struct rcu_head rcu;
+};
+
+/* current arena target, replaced as a whole under arena_lock */
+static struct mm_arena_code __rcu *arena_code;
+static DEFINE_SPINLOCK(arena_lock);
+/* source of mm_arena_code.seq, protected by arena_lock */
+static u64 arena_seq;
+
+/**
+ * mm_arena_publish() - make @code the target of every arena game
+ * @code: NUM_PEGS peg values
+ * @colors: number of colors @code was chosen from
+ *
+ * Arena games see the new code on their next guess, without being
+ * visited; see mm_arena_sync().
+ *
+ * Return: 0 on success, -ENOMEM on error
+ */
+static int mm_arena_publish(const int code[], int colors)
+{
+	struct mm_arena_code *new, *old;
+
+	new = kmalloc(sizeof(*new), GFP_KERNEL);
+	if (!new)
+		return -ENOMEM;
+	memcpy(new->code, code, sizeof(new->code));
+	new->colors = colors;
+	new->index = mm_code_to_index(code, colors);
+
+	spin_lock(&arena_lock);
+	new->seq = ++arena_seq;
+	old = rcu_dereference_protected(arena_code, lockdep_is_held(&arena_lock));
+	rcu_assign_pointer(arena_code, new);
+	spin_unlock(&arena_lock);
+	if (old)
+		kfree_rcu(old, rcu);
+	return 0;
+}
+
+/**
+ * mm_game_target() - copy the code @game is being scored against
+ * @game: the game
+ * @code: *OUT* parameter, NUM_PEGS peg values
+ *
+ * Caller must hold device_data_lock.
+ */
+static void mm_game_target(const struct mm_game *game, int code[])
+{
+	if (game->arena) {
+		rcu_read_lock();
+		memcpy(code, rcu_dereference(arena_code)->code, NUM_PEGS * sizeof(code[0]));
+		rcu_read_unlock();
+	} else
+		memcpy(code, game->target_code, NUM_PEGS * sizeof(code[0]));
+}
+
+/**
+ * mm_score() - score @guess against @game's target
+ * @game: game to score against
+ * @guess: guess peg values
+ * @black: *OUT* parameter, number of black pegs
+ * @white: *OUT* parameter, number of white pegs
+ *
+ * A single table load when the game has a score table and both codes
+ * are on its board; mm_num_pegs() otherwise.
+ *
+ * Caller must hold device_data_lock.
+ *
+ * Return: seq of the arena code scored against, or 0 if @game is not an
+ * arena game
+ */
+static u64 mm_score(struct mm_game *game, int guess[], unsigned *black,
+		    unsigned *white)
+{
+	struct mm_arena_code *arena;
+	int *target = game->target_code;
+	int target_index = game->target_index;
+	int guess_index;
+	u64 seq = 0;
+	u8 score;
+
+	rcu_read_lock();
+	if (game->arena) {
+		arena = rcu_dereference(arena_code);
+		target = arena->code;
+		target_index = arena->colors == game->colors ? arena->index : -1;
+		seq = arena->seq;
+	}
+	if (game->scores && target_index >= 0) {
+		guess_index = mm_code_to_index(guess, game->colors);
+		if (guess_index >= 0) {
+			score = game->scores->scores[(size_t)guess_index * game->scores->space +
+						     target_index];
+			*black = MM_SCORE_BLACK(score);
+			*white = MM_SCORE_WHITE(score);
+			rcu_read_unlock();
+			return seq;
+		}
+	}
+	mm_num_pegs(target, guess, black, white);
+	rcu_read_unlock();
+	return seq;
+}
+
+/**
+ * struct mm_arena_prescore - when guesses were scored by
+ * mm_arena_prescore()
+ * @start_seq: start_seq of the game at the time
+ * @seq: seq of the arena code scored against, 0 if none was
+ */
+struct mm_arena_prescore {
+	u64 start_seq;
+	u64 seq;
+};
+
+/**
+ * mm_arena_prescore() - score guesses at an arena game before taking
+ * device_data_lock
+ * @game: referenced game the guesses apply to
+ * @guesses: @n guesses of NUM_PEGS ASCII digits each, back to back
+ * @n: number of guesses
+ * @scores: *OUT* parameter, MM_SCORE() of each guess
+ * @ps: *OUT* parameter, what mm_guess_prescored_locked() must check
+ *
+ * An arena game's target is only behind RCU, so its guesses can be
+ * scored without device_data_lock, against a single snapshot of the
+ * arena code. Other games' guesses are left to mm_guess_locked().
+ *
+ * Caller must not hold device_data_lock.
+ */
+static void mm_arena_prescore(struct mm_game *game, const char *guesses, unsigned n,
+			      u8 scores[], struct mm_arena_prescore *ps)
+{
+	struct mm_arena_code *arena;
+	int user_guess[NUM_PEGS];
+	unsigned black, white;
+	unsigned i, j;
+
+	ps->start_seq = READ_ONCE(game->start_seq);
+	ps->seq = 0;
+	if (!READ_ONCE(game->arena))
+		return;
+	rcu_read_lock();
+	arena = rcu_dereference(arena_code);
+	for (i = 0; i < n; i++) {
+		for (j = 0; j < NUM_PEGS; j++)
+			user_guess[j] = guesses[i * NUM_PEGS + j] - '0';
+		mm_num_pegs(arena->code, user_guess, &black, &white);
+		scores[i] = MM_SCORE(black, white);
+	}
+	ps->seq = arena->seq;
+	rcu_read_unlock();
+}
+
+/**
+ * mm_arena_sync() - catch @game up with arena code @seq
+ * @game: the game
+ * @seq: seq of an arena code @game has been scored against
+ *
+ * The fan-out worker does not visit arena games. Instead, the first
+ * guess or candidate update to see a newer arena code drops the earlier
+ * feedback from the candidate view, as mm_game_new_code() does for other
+ * games. Readers of an arena game are not woken by a new code, since
+ * nothing they read changes until the next guess.
+ *
+ * Caller must hold device_data_lock.
+ */
+static void mm_arena_sync(struct mm_game *game, u64 seq)
+{
+	if (!game->arena || seq <= game->arena_seq)
+		return;
+	game->arena_seq = seq;
+	/* earlier feedback was against the old code */
+	game->candidates_applied = game->history_len;
+	game->candidates_stale = true;
+}
+
+/**
+ * mm_score_word() - score @guess against the 64 codes of one bitmap word
+ * @colors: number of colors on the board
+ * @space: number of codes on the board
+ * @guess: guess peg values
+ * @word: index of the bitmap word
+ * @scores: *OUT* parameter, MM_SCORE() of each code; 0xff past @space
+ */
+static void mm_score_word(int colors, unsigned space, const int guess[],
+			  unsigned word, u8 scores[64])
+{
+	int code[NUM_PEGS];
+	unsigned black, white;
+	unsigned i;
+
+	for (i = 0; i < 64; i++) {
+		if (word * 64 + i >= space) {
+			scores[i] = 0xff;
+			continue;
+		}
+		mm_index_to_code(word * 64 + i, colors, code);
+		mm_num_pegs(code, (int *)guess, &black, &white);
+		scores[i] = MM_SCORE(black, white);
+	}
+}
+
+/**
+ * mm_match_mask() - find which of 64 scores equal @score
+ * @scores: 64 packed scores
+ * @score: packed score to look for
+ *
+ * Compares eight scores per 64-bit load: bytes equal to @score are
+ * zeroed by the XOR, then each zero byte's flag is gathered into one
+ * bit of the result with a multiply.
+ *
+ * Return: bit i set if @scores[i] == @score
+ */
+static u64 mm_match_mask(const u8 scores[64], u8 score)
+{
+	const u64 ones = 0x0101010101010101ULL;
+	u64 mask = 0;
+	u64 x, t;
+	unsigned i;
+
+	for (i = 0; i < 8; i++) {
+		x = get_unaligned_le64(scores + i * 8) ^ (ones * score);
+		t = ((x & (ones * 0x7f)) + ones * 0x7f) | x;
+		t = ~t & (ones * 0x80);
+		mask |= (((t >> 7) * 0x0102040810204080ULL) >> 56) << (i * 8);
+	}
+	return mask;
+}
+
+/**
+ * mm_candidates_filter() - drop codes inconsistent with one scored guess
+ * @game: game whose candidate view to narrow
+ * @rec: scored guess
+ *
+ * Only words that still have candidates are scored, so later guesses
+ * get cheaper as the set shrinks. With a score table the guess's row
+ * is used directly. Also recounts @remaining.
+ *
+ * Caller must hold device_data_lock.
+ */
+static void mm_candidates_filter(struct mm_game *game,
+				 const struct mm_guess_record *rec)
+{
+	struct mm_candidate_view *view = game->candidate_view;
+	unsigned words = DIV_ROUND_UP(view->space, 64);
+	unsigned remaining = 0;
+	const u8 *row = NULL;
+	int guess[NUM_PEGS];
+	int guess_index;
+	u8 scores[64];
+	unsigned w;
+	size_t i;
+
+	for (i = 0; i < NUM_PEGS; i++)
+		guess[i] = rec->guess[i] - '0';
+	guess_index = mm_code_to_index(guess, game->colors);
+	if (game->scores && guess_index >= 0)
+		row = game->scores->scores + (size_t)guess_index * view->space;
+	for (w = 0; w < words; w++) {
+		if (!view->bits[w])
+			continue;
+		if (row) {
+			/* bytes past the row belong to the next one, but those bits are clear */
+			view->bits[w] &= mm_match_mask(row + w * 64, MM_SCORE(rec->black, rec->white));
+		} else {
+			mm_score_word(game->colors, view->space, guess, w, scores);
+			view->bits[w] &= mm_match_mask(scores, MM_SCORE(rec->black, rec->white));
+		}
+		remaining += hweight64(view->bits[w]);
+	}
+	view->remaining = remaining;
+}
+
+/**
+ * mm_candidates_update() - fold unapplied history into @game's
+ * candidate view
+ * @game: game whose view to bring up to date
+ *
+ * If the target changed since the view was last used, every code
+ * becomes a candidate again and only guesses made afterwards are
+ * applied.
+ *
+ * Caller must hold device_data_lock, and @game->candidate_view must be
+ * allocated.
+ */
+static void mm_candidates_update(struct mm_game *game)
+{
+	struct mm_candidate_view *view = game->candidate_view;
+	unsigned space = mm_code_space(game->colors);
+
+	if (game->arena) {
+		rcu_read_lock();
+		mm_arena_sync(game, rcu_dereference(arena_code)->seq);
+		rcu_read_unlock();
+	}
+	if (game->candidates_stale) {
+		memset(view->bits, 0xff, (space / 64) * sizeof(view->bits[0]));
+		if (space % 64)
+			view->bits[space / 64] = (1ULL << (space % 64)) - 1;
+		view->space = space;
+		view->remaining = space;
+		game->candidates_stale = false;
+	}
+	for (; game->candidates_applied < game->history_len; game->candidates_applied++)
+		mm_candidates_filter(game, &game->history[game->candidates_applied]);
+}
+
+/**
+ * struct mm_player - what a user has achieved over all their games
+ * @by_uid: node in players_by_uid
+ * @by_rank: node in players_by_rank, once the user has won
+ * @uid: the user
+ * @games: number of games started
+ * @wins: number of games won
+ * @win_guesses: total guesses over all won games
+ * @best: fewest guesses in a won game
+ * @best_seq: start_seq of the game that set @best, so that of two
+ * players with equal @best the first to get there ranks higher
+ *
+ * Protected by device_data_lock.
+ */
+struct mm_player {
+	struct rb_node by_uid;
+	struct rb_node by_rank;
+	kuid_t uid;
+	unsigned games;
+	unsigned wins;
+	u64 win_guesses;
+	unsigned best;
+	u64 best_seq;
+};
+
+/* struct mm_player by uid, and the players with a win best first */
+static struct rb_root players_by_uid = RB_ROOT;
+static struct rb_root players_by_rank = RB_ROOT;
+
+/**
+ * mm_player_get() - find or create the record of @uid
+ *
+ * Caller must hold device_data_lock.
+ *
+ * Return: the record, or %NULL if out of memory or @uid is invalid, as
+ * for self-benchmark games
+ */
+static struct mm_player *mm_player_get(kuid_t uid)
+{
+	struct rb_node **link = &players_by_uid.rb_node, *parent = NULL;
+	struct mm_player *player;
+
+	if (!uid_valid(uid))
+		return NULL;
+	while (*link) {
+		parent = *link;
+		player = rb_entry(parent, struct mm_player, by_uid);
+		if (uid_eq(uid, player->uid))
+			return player;
+		link = uid_lt(uid, player->uid) ? &parent->rb_left : &parent->rb_right;
+	}
+	player = kzalloc(sizeof(*player), GFP_ATOMIC);
+	if (!player)
+		return NULL;
+	player->uid = uid;
+	RB_CLEAR_NODE(&player->by_rank);
+	rb_link_node(&player->by_uid, parent, link);
+	rb_insert_color(&player->by_uid, &players_by_uid);
+	return player;
+}
+
+/* whether @a ranks above @b: fewer guesses, then earlier, then lower uid */
+static bool mm_player_before(const struct mm_player *a, const struct mm_player *b)
+{
+	if (a->best != b->best)
+		return a->best < b->best;
+	if (a->best_seq != b->best_seq)
+		return a->best_seq < b->best_seq;
+	return uid_lt(a->uid, b->uid);
+}
+
+/**
+ * mm_player_won() - record that @game was won, and re-rank its user
+ * @game: the game, with num_guesses counting the winning guess
+ *
+ * Caller must hold device_data_lock.
+ */
+static void mm_player_won(struct mm_game *game)
+{
+	struct mm_player *player = mm_player_get(game->uid), *other;
+	struct rb_node **link = &players_by_rank.rb_node, *parent = NULL;
+
+	if (!player)
+		return;
+	player->wins++;
+	player->win_guesses += game->num_guesses;
+	if (!RB_EMPTY_NODE(&player->by_rank)) {
+		if (player->best <= game->num_guesses)
+			return;
+		rb_erase(&player->by_rank, &players_by_rank);
+	}
+	player->best = game->num_guesses;
+	player->best_seq = game->start_seq;
+
+	while (*link) {
+		parent = *link;
+		other = rb_entry(parent, struct mm_player, by_rank);
+		link = mm_player_before(player, other) ? &parent->rb_left : &parent->rb_right;
+	}
+	rb_link_node(&player->by_rank, parent, link);
+	rb_insert_color(&player->by_rank, &players_by_rank);
+}
+
+/**
+ * mm_players_free() - forget every player, when unloading
+ */
+static void mm_players_free(void)
+{
+	struct mm_player *player, *tmp;
+
+	rbtree_postorder_for_each_entry_safe(player, tmp, &players_by_uid, by_uid)
+		kfree(player);
+	players_by_uid = RB_ROOT;
+	players_by_rank = RB_ROOT;
+}
+
+/**
+ * mm_game_changed() - wake every reader and poller of @game
+ *
+ * Called whenever what a read of /dev/mm returns for @game may have
+ * changed: a guess, a start or end of the game, a new target code, or
+ * @game being dropped from the registry.
+ *
+ * Caller must hold device_data_lock.
+ */
+static void mm_game_changed(struct mm_game *game)
+{
+	struct mm_file *file;
+
+	game->state_seq++;
+	list_for_each_entry(file, &game->watchers, watch)
+		wake_up_interruptible_poll(&file->waitq, EPOLLIN | EPOLLRDNORM);
+}
+
+/**
+ * initialize_game() - initializes all required variables for the game
+ * @game: game to (re)start
+ * @colors: number of colors on the new game's board
+ *
+ * Self-benchmark games are not counted in the statistics, nor as a
+ * game of their user.
+ *
+ * Caller must hold device_data_lock.
+ * */
+static void initialize_game(struct mm_game * game, int colors)
+{
+	struct mm_player *player;
+	size_t i;
+	game->target_code[0] = 4;
+	game->target_code[1] = 2;
+	game->target_code[2] = 1;
+	game->target_code[3] = 1;
+	if (READ_ONCE(random_codes))
+		mm_random_code(colors, game->target_code);
+	game->colors = colors;
+	game->target_index = mm_code_to_index(game->target_code, game->colors);
+	game->arena = false;
+	mm_score_table_put(game->scores);
+	game->scores = mm_score_table_get(game->colors);
+	game->num_guesses = 0;
+	game->history_len = 0;
+	game->candidates_applied = 0;
+	game->candidates_stale = true;
+	game->track_candidates = track_candidates;
+	for (i = 0; i < MM_USER_VIEW_PAGES; i++)
+	{
+		if (game->user_view[i])
+			clear_page(page_address(game->user_view[i]));
+	}
+	game->user_view_size = 0;
+	if (!game->bench) {
+		if (!game->game_active)
+			games_active++;
+		games_started++;
+		player = mm_player_get(game->uid);
+		if (player)
+			player->games++;
+	}
+	game->game_active = true;
+	game->start_seq = ++games_start_seq;
+	/* network codes sent before the start no longer apply */
+	game->code_seq = fanout_seq;
+	game->last_result[0] = 'B';
+	game->last_result[1] = '-';
+	game->last_result[2] = 'W';
+	game->last_result[3] = '-';
+	mm_game_changed(game);
+}
+
+/**
+ * mm_end_game() - mark @game as no longer being played
+ *
+ * Caller must hold device_data_lock.
+ */
+static void mm_end_game(struct mm_game *game)
+{
+	if (!game->game_active)
+		return;
+	if (!game->bench)
+		games_active--;
+	game->game_active = false;
+	mm_game_changed(game);
+}
+
+/**
+ * mm_unregister_game() - make @game unreachable through mm_lookup_game()
+ *
+ * The caller takes @game off game_list and drops the registry's
+ * reference. Files still remembering @game are woken so that blocked
+ * readers look up their user's new game.
+ *
+ * Caller must hold device_data_lock.
+ */
+static void mm_unregister_game(struct mm_game *game)
+{
+	game->registered = false;
+	games_allocated--;
+	mm_end_game(game);
+	mm_game_changed(game);
+}
+
+/**
+ * mm_lookup_game() - find the game belonging to @uid
+ * @uid: user whose game to find
+ *
+ * Caller must hold device_data_lock.
+ *
+ * Return: the game, or %NULL if @uid has never played
+ */
+static struct mm_game *mm_lookup_game(kuid_t uid)
+{
+	struct mm_game *game;
+
+	list_for_each_entry(game, &game_list, list) {
+		if (!game->per_file && uid_eq(game->uid, uid))
+			return game;
+	}
+	return NULL;
+}
+
+/**
+ * mm_user_view_free() - free every page of @game's user view
+ *
+ * Return: number of pages freed
+ */
+static unsigned mm_user_view_free(struct mm_game *game)
+{
+	unsigned i, freed = 0;
+
+	for (i = 0; i < MM_USER_VIEW_PAGES; i++) {
+		if (!game->user_view[i])
+			continue;
+		__free_page(game->user_view[i]);
+		game->user_view[i] = NULL;
+		atomic_dec(&history_pages);
+		freed++;
+	}
+	return freed;
+}
+
+static void mm_free_game(struct mm_game *game)
+{
+	if (game->shard) {
+		spin_lock(&game->shard->lock);
+		list_del(&game->shard_node);
+		spin_unlock(&game->shard->lock);
+	}
+	mm_score_table_put(game->scores);
+	if (game->candidate_view)
+		atomic_dec(&history_pages);
+	vfree(game->candidate_view);
+	kfree(game->history);
+	mm_user_view_free(game);
+	kmem_cache_free(mm_game_cache, game);
+}
+
+static void mm_game_release(struct kref *ref)
+{
+	mm_free_game(container_of(ref, struct mm_game, ref));
+}
+
+/**
+ * mm_put_game() - drop a reference taken by mm_find_game(),
+ * mm_file_game() or mm_alloc_game()
+ *
+ * Caller must not hold device_data_lock.
+ */
+static void mm_put_game(struct mm_game *game)
+{
+	kref_put(&game->ref, mm_game_release);
+}
+
+/**
+ * mm_game_frees_pages() - check whether evicting @game would free
+ * history pages right away
+ *
+ * That is when it has pages, is not mapped, and nothing but game_list
+ * holds a reference, so that neither an open file nor a caller in the
+ * middle of a system call is using it.
+ *
+ * Caller must hold device_data_lock.
+ */
+static bool mm_game_frees_pages(struct mm_game *game)
+{
+	unsigned i;
+
+	if (game->user_view_maps || kref_read(&game->ref) != 1)
+		return false;
+	if (game->candidate_view)
+		return true;
+	for (i = 0; i < MM_USER_VIEW_PAGES; i++)
+		if (game->user_view[i])
+			return true;
+	return false;
+}
+
+/**
+ * mm_evict_lru_game() - free the least recently used per-user game
+ * @for_pages: only consider games whose eviction frees history pages
+ *
+ * Return: true if a game was taken off game_list, and with @for_pages
+ * its pages were freed
+ */
+static bool mm_evict_lru_game(bool for_pages)
+{
+	struct mm_game *game, *victim = NULL;
+
+	spin_lock(&device_data_lock);
+	list_for_each_entry(game, &game_list, list) {
+		if (!game->per_file && (!for_pages || mm_game_frees_pages(game))) {
+			victim = game;
+			break;
+		}
+	}
+	if (victim) {
+		list_del_init(&victim->list);
+		mm_unregister_game(victim);
+		games_evicted++;
+	}
+	spin_unlock(&device_data_lock);
+	if (!victim)
+		return false;
+	/* a lookup may have taken a reference since */
+	return kref_put(&victim->ref, mm_game_release) || !for_pages;
+}
+
+/**
+ * mm_reserve_history_page() - account for one more user view or
+ * candidate page, evicting games if max_history_pages is reached
+ *
+ * Only games whose pages are freed at once are evicted, and eviction
+ * stops as soon as one frees nothing.
+ *
+ * Return: 0 on success, -ENOSPC if no page could be freed
+ */
+static int mm_reserve_history_page(void)
+{
+	unsigned limit = READ_ONCE(max_history_pages);
+
+	while (limit && atomic_read(&history_pages) >= limit) {
+		if (!mm_evict_lru_game(true))
+			return -ENOSPC;
+	}
+	atomic_inc(&history_pages);
+	return 0;
+}
+
+/**
+ * mm_candidates_prepare() - allocate @game's candidate view if needed
+ * @game: game to prepare
+ *
+ * Caller must not hold device_data_lock.
+ *
+ * Return: 0 on success, negative on error
+ */
+static int mm_candidates_prepare(struct mm_game *game)
+{
+	struct mm_candidate_view *view;
+
+	BUILD_BUG_ON(sizeof(*view) + DIV_ROUND_UP(MM_MAX_COLORS * MM_MAX_COLORS *
+						  MM_MAX_COLORS * MM_MAX_COLORS, 64) *
+		     sizeof(view->bits[0]) > PAGE_SIZE);
+	if (READ_ONCE(game->candidate_view))
+		return 0;
+	if (mm_reserve_history_page())
+		return -ENOSPC;
+	view = vzalloc_node(PAGE_SIZE, game->node);
+	if (!view) {
+		atomic_dec(&history_pages);
+		return -ENOMEM;
+	}
+	spin_lock(&device_data_lock);
+	if (!game->candidate_view) {
+		game->candidate_view = view;
+		view = NULL;
+	}
+	spin_unlock(&device_data_lock);
+	if (view) {
+		atomic_dec(&history_pages);
+		vfree(view);
+	}
+	return 0;
+}
+
+/**
+ * mm_alloc_game() - allocate a game that has not been started
+ * @uid: user the game belongs to
+ *
+ * The game, its history and later its user view and candidate pages
+ * live on the NUMA node of the CPU that allocates it, which is where
+ * its player is most likely to keep guessing from.
+ *
+ * Return: the game, holding one reference, or %NULL
+ */
+static struct mm_game *mm_alloc_game(kuid_t uid)
+{
+	int cpu = raw_smp_processor_id();
+	struct mm_game *game;
+
+	game = kmem_cache_alloc_node(mm_game_cache, GFP_KERNEL | __GFP_ZERO, cpu_to_node(cpu));
+	if (!game)
+		return NULL;
+	kref_init(&game->ref);
+	INIT_LIST_HEAD(&game->watchers);
+	game->uid = uid;
+	game->node = cpu_to_node(cpu);
+	game->last_used = jiffies;
+	game->history = kcalloc_node(MM_HISTORY_MAX, sizeof(*game->history), GFP_KERNEL,
+				     game->node);
+	if (!game->history)
+	{
+		pr_err("Could not allocate memory\n");
+		mm_free_game(game);
+		return NULL;
+	}
+	game->shard = per_cpu_ptr(&mm_shards, cpu);
+	spin_lock(&game->shard->lock);
+	list_add_tail(&game->shard_node, &game->shard->games);
+	spin_unlock(&game->shard->lock);
+	return game;
+}
+
+/**
+ * mm_touch_game() - take a reference on @game and mark it most
+ * recently used
+ *
+ * Caller must hold device_data_lock.
+ */
+static void mm_touch_game(struct mm_game *game)
+{
+	kref_get(&game->ref);
+	game->last_used = jiffies;
+	if (!list_empty(&game->list))
+		list_move_tail(&game->list, &game_list);
+}
+
+/**
+ * mm_find_game() - find or create the game belonging to @uid
+ * @uid: user whose game to find
+ *
+ * Release the game with mm_put_game() when done with it.
+ *
+ * Return: the game, or ERR_PTR(-ENOMEM) or ERR_PTR(-ENOSPC)
+ */
+static struct mm_game *mm_find_game(kuid_t uid){
+	struct mm_game * game, * new ;
+	unsigned limit;
+
+	spin_lock(&device_data_lock);
+	game = mm_lookup_game(uid);
+	if (game)
+		mm_touch_game(game);
+	spin_unlock(&device_data_lock);
+	if (game)
+		return game;
+
+	limit = READ_ONCE(max_games);
+	while (limit && READ_ONCE(games_allocated) >= limit) {
+		if (!mm_evict_lru_game(false))
+			return ERR_PTR(-ENOSPC);
+	}
+	new = mm_alloc_game(uid);
+	if (!new)
+		return ERR_PTR(-ENOMEM);
+
+	spin_lock(&device_data_lock);
+	game = mm_lookup_game(uid);
+	if (!game) {
+		list_add_tail(&new->list, &game_list);
+		new->registered = true;
+		games_allocated++;
+		game = new;
+		new = NULL;
+	}
+	mm_touch_game(game);
+	spin_unlock(&device_data_lock);
+	if (new)
+		mm_put_game(new);
+	return game;
+}
+
+/**
+ * struct mm_rate_bucket - guess rate limit of one user
+ * @node: entry on rate_buckets
+ * @uid: user the bucket belongs to
+ * @tat: time in ns at which the bucket is full again; every guess
+ * pushes it 1/guess_rate seconds later
+ * @rcu: for freeing once lockless lookups are done with the bucket
+ */
+struct mm_rate_bucket {
+	struct hlist_node node;
+	kuid_t uid;
+	atomic64_t tat;
+	struct rcu_head rcu;
+};
+
+/* struct mm_rate_bucket by uid; looked up under RCU, changed under rate_lock */
+static DEFINE_HASHTABLE(rate_buckets, 8);
+static DEFINE_SPINLOCK(rate_lock);
+
+/**
+ * mm_rate_bucket() - find or create the rate limit bucket of @uid
+ *
+ * Caller must be in an RCU read-side critical section.
+ *
+ * Return: the bucket, or %NULL if out of memory
+ */
+static struct mm_rate_bucket *mm_rate_bucket(kuid_t uid)
+{
+	struct mm_rate_bucket *bucket, *new;
+
+	hash_for_each_possible_rcu(rate_buckets, bucket, node, __kuid_val(uid)) {
+		if (uid_eq(bucket->uid, uid))
+			return bucket;
+	}
+	new = kzalloc(sizeof(*new), GFP_ATOMIC);
+	if (!new)
+		return NULL;
+	new->uid = uid;
+	spin_lock(&rate_lock);
+	hash_for_each_possible(rate_buckets, bucket, node, __kuid_val(uid)) {
+		if (uid_eq(bucket->uid, uid)) {
+			spin_unlock(&rate_lock);
+			kfree(new);
+			return bucket;
+		}
+	}
+	hash_add_rcu(rate_buckets, &new->node, __kuid_val(uid));
+	spin_unlock(&rate_lock);
+	return new;
+}
+
+/**
+ * mm_rate_take() - take tokens for up to @n guesses by @uid
+ * @uid: user making the guesses
+ * @n: number of guesses wanted
+ *
+ * Each user has a bucket of guess_burst tokens refilled at guess_rate
+ * per second, kept as the time at which it is full again so that one
+ * cmpxchg updates it without a lock. Refused guesses are counted in
+ * guesses_throttled.
+ *
+ * Return: number of guesses, at most @n, that may be scored now
+ */
+static unsigned mm_rate_take(kuid_t uid, unsigned n)
+{
+	unsigned rate = READ_ONCE(guess_rate);
+	struct mm_rate_bucket *bucket;
+	u64 now, interval, limit, base;
+	unsigned taken;
+	s64 old;
+
+	if (!rate || !n)
+		return n;
+	interval = max_t(u64, NSEC_PER_SEC / rate, 1);
+	now = ktime_get_ns();
+	limit = now + max(READ_ONCE(guess_burst), 1U) * interval;
+
+	rcu_read_lock();
+	bucket = mm_rate_bucket(uid);
+	if (!bucket) {
+		rcu_read_unlock();
+		return n;
+	}
+	old = atomic64_read(&bucket->tat);
+	do {
+		base = max_t(u64, old, now);
+		taken = base < limit ? min_t(u64, n, div64_u64(limit - base, interval)) : 0;
+	} while (taken && !atomic64_try_cmpxchg(&bucket->tat, &old, base + taken * interval));
+	rcu_read_unlock();
+
+	if (taken < n)
+		atomic_long_add(n - taken, &guesses_throttled);
+	return taken;
+}
+
+/**
+ * mm_rate_reclaim() - free rate limit buckets that are full again
+ * @all: free every bucket, when unloading
+ *
+ * A full bucket behaves like no bucket at all. A user guessing just as
+ * the bucket goes may get up to guess_burst guesses more than allowed.
+ */
+static void mm_rate_reclaim(bool all)
+{
+	struct mm_rate_bucket *bucket;
+	struct hlist_node *tmp;
+	u64 now = ktime_get_ns();
+	int bkt;
+
+	spin_lock(&rate_lock);
+	hash_for_each_safe(rate_buckets, bkt, tmp, bucket, node) {
+		if (!all && (u64)atomic64_read(&bucket->tat) > now)
+			continue;
+		hash_del_rcu(&bucket->node);
+		kfree_rcu(bucket, rcu);
+	}
+	spin_unlock(&rate_lock);
+}
+
+/**
+ * mm_game_expired() - check whether @game has been idle for too long
+ *
+ * Caller must hold device_data_lock.
+ */
+static bool mm_game_expired(struct mm_game *game)
+{
+	unsigned timeout = game->game_active ? READ_ONCE(idle_timeout) :
+		READ_ONCE(finished_timeout);
+
+	if (game->per_file || !timeout)
+		return false;
+	return time_after(jiffies, game->last_used + (unsigned long)timeout * HZ);
+}
+
+/**
+ * mm_reclaim_work_func() - free per-user games nobody has touched for
+ * idle_timeout (or finished_timeout once won or quit) seconds
+ *
+ * A user whose game was freed simply gets a new, inactive one on
+ * their next access.
+ */
+static void mm_reclaim_work_func(struct work_struct *work)
+{
+	struct mm_game *game, *tmp;
+	LIST_HEAD(victims);
+
+	spin_lock(&device_data_lock);
+	list_for_each_entry_safe(game, tmp, &game_list, list) {
+		if (!mm_game_expired(game))
+			continue;
+		list_move_tail(&game->list, &victims);
+		mm_unregister_game(game);
+		games_reclaimed++;
+	}
+	mm_score_table_reclaim();
+	spin_unlock(&device_data_lock);
+
+	list_for_each_entry_safe(game, tmp, &victims, list) {
+		list_del_init(&game->list);
+		mm_put_game(game);
+	}
+	mm_rate_reclaim(false);
+	schedule_delayed_work(to_delayed_work(work), MM_RECLAIM_INTERVAL);
+}
+
+static DECLARE_DELAYED_WORK(reclaim_work, mm_reclaim_work_func);
+
+/**
+ * mm_user_view_shrinkable() - check whether @game's user view may be
+ * dropped
+ *
+ * The view is rebuilt from the game's history when next mapped, so
+ * it may go once the game is over or idle, unless it is mapped.
+ *
+ * Caller must hold device_data_lock.
+ */
+static bool mm_user_view_shrinkable(struct mm_game *game)
+{
+	if (!game->user_view_size || game->user_view_maps)
+		return false;
+	return !game->game_active || time_after(jiffies, game->last_used + MM_SHRINK_IDLE);
+}
+
+static unsigned long mm_shrink_count(struct shrinker *shrinker,
+				     struct shrink_control *sc)
+{
+	struct mm_game *game;
+	unsigned long count = 0;
+
+	unsigned i;
+
+	spin_lock(&device_data_lock);
+	list_for_each_entry(game, &game_list, list) {
+		if (!mm_user_view_shrinkable(game))
+			continue;
+		for (i = 0; i < MM_USER_VIEW_PAGES; i++)
+			if (game->user_view[i])
+				count++;
+	}
+	spin_unlock(&device_data_lock);
+	return count ? count : SHRINK_EMPTY;
+}
+
+/**
+ * mm_shrink_scan() - free about @sc->nr_to_scan user view pages of
+ * finished or idle games, least recently used first
+ */
+static unsigned long mm_shrink_scan(struct shrinker *shrinker,
+				    struct shrink_control *sc)
+{
+	struct mm_game *game;
+	unsigned long freed = 0;
+
+	spin_lock(&device_data_lock);
+	list_for_each_entry(game, &game_list, list) {
+		if (freed >= sc->nr_to_scan)
+			break;
+		if (mm_user_view_shrinkable(game))
+			freed += mm_user_view_free(game);
+	}
+	views_shrunk += freed;
+	spin_unlock(&device_data_lock);
+	return freed ? freed : SHRINK_STOP;
+}
+
+static struct shrinker mm_shrinker = {
+	.count_objects = mm_shrink_count,
+	.scan_objects = mm_shrink_scan,
+	.seeks = DEFAULT_SEEKS,
+};
+
+/**
+ * mm_file_game() - find the game a /dev/mm operation applies to
+ * @filp: process's file object
+ *
+ * The per-user game is remembered in @filp, so repeated calls skip the
+ * registry lookup as long as the game was not freed in between and the
+ * caller is still its user.
+ *
+ * Release the game with mm_put_game() when done with it.
+ *
+ * Return: the game bound to @filp if it has one, otherwise the
+ * caller's per-user game (see mm_find_game())
+ */
+static struct mm_game *mm_file_game(struct file *filp)
+{
+	struct mm_file *file = filp->private_data;
+	kuid_t uid = current_cred()->uid;
+	struct mm_game *game, *old;
+
+	spin_lock(&device_data_lock);
+	game = file->game;
+	if (game && (game->per_file || (game->registered && uid_eq(game->uid, uid)))) {
+		mm_touch_game(game);
+		spin_unlock(&device_data_lock);
+		return game;
+	}
+	spin_unlock(&device_data_lock);
+
+	game = mm_find_game(uid);
+	if (IS_ERR(game))
+		return game;
+	kref_get(&game->ref);
+	spin_lock(&device_data_lock);
+	old = file->game;
+	file->game = game;
+	list_move_tail(&file->watch, &game->watchers);
+	/* whatever the file read of its old game, it has not seen this one */
+	file->seen_seq = game->state_seq - 1;
+	/* readers blocked on the old game must wait on this one instead */
+	wake_up_interruptible_poll(&file->waitq, EPOLLIN | EPOLLRDNORM);
+	spin_unlock(&device_data_lock);
+	if (old)
+		mm_put_game(old);
+	return game;
+}
+
+/* Copy mm_read(), mm_write(), mm_mmap(), and mm_ctl_write(), along
+ * with all of your global variables and helper functions here.
+ */
+/* Part 1: YOUR CODE HERE */
+
+/**
+ * compare_strings() - takes in two char strings along with their sizes and checks if both strings
+ * are equal or not 
+ * @source_string: source string to compare
+ * @source_size: size of source string
+ * @dest_stirng: destination string
+ * @dest_size: size of destination string
+ * */
+static bool compare_strings(const char *source_string, size_t source_size, const char *dest_string, size_t dest_size)
+{
+	/* a prefix such as "s" must not match "start" */
+	if (source_size != dest_size)
+	{
+		return false;
+	}
+	return memcmp(source_string, dest_string, source_size) == 0;
+}
+
+/**
+ * mm_file_changed() - check whether @file has a state of @game to read
+ * @file: open /dev/mm
+ * @game: game @file remembered when the caller looked it up
+ *
+ * Also true once @file has moved on to another game, which the caller
+ * then has to look up again.
+ */
+static bool mm_file_changed(struct mm_file *file, struct mm_game *game)
+{
+	return READ_ONCE(file->game) != game ||
+		READ_ONCE(game->state_seq) != READ_ONCE(file->seen_seq);
+}
+
+/**
+ * mm_wait_for_change() - wait until @filp's game changes after the
+ * last result read in full through @filp
+ * @filp: process's file object that is reading from this device
+ * @nonblock: fail with -EAGAIN rather than sleep
+ *
+ * Return: 0 once there is a new result to read, -EAGAIN if @nonblock
+ * and there is none yet, -ERESTARTSYS if interrupted by a signal, or
+ * other negative error
+ */
+static int mm_wait_for_change(struct file *filp, bool nonblock)
+{
+	struct mm_file *file = filp->private_data;
+	struct mm_game *game;
+	bool changed;
+	int retval;
+
+	for (;;) {
+		game = mm_file_game(filp);
+		if (IS_ERR(game))
+			return PTR_ERR(game);
+		changed = READ_ONCE(game->state_seq) != READ_ONCE(file->seen_seq);
+		if (changed || nonblock) {
+			mm_put_game(game);
+			return changed ? 0 : -EAGAIN;
+		}
+		retval = wait_event_interruptible(file->waitq, mm_file_changed(file, game));
+		mm_put_game(game);
+		if (retval)
+			return retval;
+	}
+}
+
+/**
+ * mm_read_result() - snapshot what a read of /dev/mm returns
+ * @filp: process's file object that is reading from this device
+ * @result: set to the four characters described at mm_read()
+ * @consume: the read reaches the end of @result, so later reads past
+ * it wait for the game to change again
+ *
+ * copy_to_user() may fault and sleep, so the result is copied out
+ * under the lock first.
+ *
+ * Return: 0 on success, negative on error
+ */
+static int mm_read_result(struct file *filp, char *result, bool consume)
+{
+	struct mm_file *file = filp->private_data;
+	struct mm_game *game = mm_file_game(filp);
+
+	if (IS_ERR(game))
+		return PTR_ERR(game);
+	spin_lock(&device_data_lock);
+	if (!game->game_active)
+		memcpy(result, "????", NUM_PEGS);
+	else if (file->game == game && file->result_seq == game->start_seq)
+		memcpy(result, file->last_result, NUM_PEGS);
+	else
+		memcpy(result, game->last_result, NUM_PEGS);
+	if (consume && file->game == game)
+		file->seen_seq = game->state_seq;
+	spin_unlock(&device_data_lock);
+	mm_put_game(game);
+	return 0;
+}
+
+/**
+ * mm_read() - callback invoked when a process reads from
+ * /dev/mm
+ * @filp: process's file object that is reading from this device
+ * @ubuf: destination buffer to store output
+ * @count: number of bytes in @ubuf
+ * @ppos: file offset (in/out parameter)
+ *
+ * Write to @ubuf the last result of the game, from offset
+ * @ppos on. Copy the lesser of @count and (string length of @last_result
+ * - *@ppos). Then increment the value pointed to by @ppos by the
+ * number of bytes copied. If @ppos is greater than or equal to the
+ * length of @last_result, then copy nothing.
+ *
+ * If @filp itself wrote a guess since the game last started, the
+ * result is that of its own latest guess, even if another writer or
+ * a code change came in between. A write() followed by a pread() at
+ * offset 0 therefore works as one guess-and-score transaction.
+ *
+ * If no game is active, instead copy to @ubuf up to four '?'
+ * characters.
+ *
+ * A read at or past the end of the result returns 0. If MM_IOC_FOLLOW
+ * was set on @filp, such a read instead waits until the game changes
+ * (a guess, a start or end of the game, or a new target code from the
+ * network), then rewinds @ppos and returns the new result. Repeated
+ * read() calls thus follow the game as a stream of results. With
+ * O_NONBLOCK such a read fails with -EAGAIN instead; mm_poll() tells
+ * when it would succeed.
+ *
+ * Return: number of bytes written to @ubuf, or negative on error
+ */
+static ssize_t mm_read(struct file *filp, char __user *ubuf, size_t count,
+					   loff_t *ppos)
+{
+	int copy_result;
+	size_t bytes_to_copy;
+	char result[4];
+	if (*ppos >= 4)
+	{
+		if (!READ_ONCE(((struct mm_file *)filp->private_data)->follow))
+			return 0;
+		copy_result = mm_wait_for_change(filp, filp->f_flags & O_NONBLOCK);
+		if (copy_result)
+			return copy_result;
+		*ppos = 0;
+	}
+	bytes_to_copy = min_t(size_t, 4 - *ppos, count);
+	if (!bytes_to_copy)
+		return 0;
+	copy_result = mm_read_result(filp, result, *ppos + bytes_to_copy >= 4);
+	if (copy_result)
+		return copy_result;
+
+	/* @ubuf receives the result from *@ppos on, so it starts at its beginning */
+	copy_result = copy_to_user(ubuf, result + *ppos, bytes_to_copy);
+	if (copy_result != 0)
+	{
+		return -EFAULT;
+	}
+	*ppos += bytes_to_copy;
+	return bytes_to_copy;
+}
+
+/**
+ * mm_read_iter() - callback invoked for vectored reads of /dev/mm,
+ * such as readv() and io_uring
+ * @iocb: I/O control block of the read
+ * @to: destination of the read
+ *
+ * Copy what mm_read() would return from @iocb->ki_pos on, spread over
+ * as many segments of @to as needed. Past the result, return 0 or wait
+ * for the game to change as mm_read() does; an IOCB_NOWAIT read from
+ * io_uring fails with -EAGAIN instead of waiting, and io_uring then
+ * arms mm_poll().
+ *
+ * Return: number of bytes copied, or negative on error
+ */
+static ssize_t mm_read_iter(struct kiocb *iocb, struct iov_iter *to)
+{
+	struct file *filp = iocb->ki_filp;
+	char result[NUM_PEGS];
+	size_t copied;
+	int retval;
+
+	if (iocb->ki_pos < 0 || !iov_iter_count(to))
+		return 0;
+	if (iocb->ki_pos >= NUM_PEGS) {
+		if (!READ_ONCE(((struct mm_file *)filp->private_data)->follow))
+			return 0;
+		retval = mm_wait_for_change(filp, (filp->f_flags & O_NONBLOCK) ||
+					    (iocb->ki_flags & IOCB_NOWAIT));
+		if (retval)
+			return retval;
+		iocb->ki_pos = 0;
+	}
+	retval = mm_read_result(filp, result,
+				iocb->ki_pos + iov_iter_count(to) >= NUM_PEGS);
+	if (retval)
+		return retval;
+	copied = copy_to_iter(result + iocb->ki_pos, NUM_PEGS - iocb->ki_pos, to);
+	if (!copied)
+		return -EFAULT;
+	iocb->ki_pos += copied;
+	return copied;
+}
+
+/**
+ * mm_poll() - callback invoked when a process polls /dev/mm
+ * @filp: process's file object
+ * @wait: poll table to register @filp's wait queue in
+ *
+ * /dev/mm is readable while its game has changed since @filp last read
+ * a whole result, that is while a read past the result would not
+ * block if MM_IOC_FOLLOW were set. Writes never block.
+ *
+ * Return: poll event mask
+ */
+static __poll_t mm_poll(struct file *filp, poll_table *wait)
+{
+	struct mm_file *file = filp->private_data;
+	struct mm_game *game;
+	__poll_t mask = EPOLLOUT | EPOLLWRNORM;
+
+	poll_wait(filp, &file->waitq, wait);
+	game = mm_file_game(filp);
+	if (IS_ERR(game))
+		return EPOLLERR;
+	if (READ_ONCE(game->state_seq) != READ_ONCE(file->seen_seq))
+		mask |= EPOLLIN | EPOLLRDNORM;
+	mm_put_game(game);
+	return mask;
+}
+
+/**
+ * mm_user_view_line() - render line @n of @game's user view
+ * @game: game whose history to render
+ * @n: line number, counting from 0
+ * @line: destination of USER_VIEW_LINE_SIZE bytes, NUL-padded
+ *
+ * Line n shows guess n + 1 of the history; after a winning guess
+ * follows a line announcing the win.
+ *
+ * Caller must hold device_data_lock.
+ */
+static void mm_user_view_line(const struct mm_game *game, unsigned n, char *line)
+{
+	const struct mm_guess_record *rec;
+
+	memset(line, 0, USER_VIEW_LINE_SIZE);
+	if (n < game->history_len) {
+		rec = &game->history[n];
+		scnprintf(line, USER_VIEW_LINE_SIZE, "Guess %u: B%uW%u | %.*s\n",
+			  n + 1, rec->black, rec->white, NUM_PEGS, rec->guess);
+	}
+	else {
+		strscpy(line, "You won, game over!\n", USER_VIEW_LINE_SIZE);
+	}
+}
+
+/**
+ * mm_user_view_lines() - number of lines @game's history renders to
+ *
+ * Caller must hold device_data_lock.
+ */
+static unsigned mm_user_view_lines(const struct mm_game *game)
+{
+	unsigned lines = game->history_len;
+
+	if (lines && game->history[lines - 1].black == NUM_PEGS)
+		lines++;
+	return lines;
+}
+
+/**
+ * mm_user_view_store() - copy line @n into those of @game's user view
+ * pages that exist
+ *
+ * Lines may straddle a page boundary. Missing pages are rendered from
+ * history when they are faulted in.
+ *
+ * Caller must hold device_data_lock.
+ */
+static void mm_user_view_store(struct mm_game *game, unsigned n, const char *line)
+{
+	size_t pos = (size_t)n * USER_VIEW_LINE_SIZE;
+	size_t end = pos + USER_VIEW_LINE_SIZE;
+	size_t chunk;
+	struct page *page;
+
+	for (; pos < end; pos += chunk) {
+		chunk = min_t(size_t, end - pos, PAGE_SIZE - pos % PAGE_SIZE);
+		page = game->user_view[pos / PAGE_SIZE];
+		if (page)
+			memcpy(page_address(page) + pos % PAGE_SIZE,
+			       line + (pos + USER_VIEW_LINE_SIZE - end), chunk);
+	}
+}
+
+/**
+ * mm_user_view_sync() - append the lines of guesses not yet rendered
+ * into @game's user view
+ *
+ * Guesses past MM_HISTORY_MAX are not recorded, so they do not show
+ * up in the user view either.
+ *
+ * Caller must hold device_data_lock.
+ */
+static void mm_user_view_sync(struct mm_game *game)
+{
+	char line[USER_VIEW_LINE_SIZE];
+	unsigned n = game->user_view_size / USER_VIEW_LINE_SIZE;
+	unsigned lines = mm_user_view_lines(game);
+
+	for (; n < lines; n++) {
+		mm_user_view_line(game, n, line);
+		mm_user_view_store(game, n, line);
+	}
+	game->user_view_size = (size_t)lines * USER_VIEW_LINE_SIZE;
+}
+
+/**
+ * mm_user_view_populate() - allocate and render page @pgoff of @game's
+ * user view if it does not exist
+ * @game: game to populate
+ * @pgoff: page of the user view
+ *
+ * Caller must not hold device_data_lock.
+ *
+ * Return: the page, or ERR_PTR(-ENOMEM) or ERR_PTR(-ENOSPC)
+ */
+static struct page *mm_user_view_populate(struct mm_game *game, pgoff_t pgoff)
+{
+	char line[USER_VIEW_LINE_SIZE];
+	struct page *page, *new;
+	unsigned n, last;
+
+	page = READ_ONCE(game->user_view[pgoff]);
+	if (page)
+		return page;
+	if (mm_reserve_history_page())
+		return ERR_PTR(-ENOSPC);
+	new = alloc_pages_node(game->node, GFP_KERNEL | __GFP_ZERO, 0);
+	if (!new) {
+		atomic_dec(&history_pages);
+		return ERR_PTR(-ENOMEM);
+	}
+	spin_lock(&device_data_lock);
+	page = game->user_view[pgoff];
+	if (!page) {
+		page = new;
+		new = NULL;
+		game->user_view[pgoff] = page;
+		n = pgoff * PAGE_SIZE / USER_VIEW_LINE_SIZE;
+		last = min_t(size_t, game->user_view_size / USER_VIEW_LINE_SIZE,
+			     DIV_ROUND_UP((pgoff + 1) * PAGE_SIZE, USER_VIEW_LINE_SIZE));
+		for (; n < last; n++) {
+			mm_user_view_line(game, n, line);
+			mm_user_view_store(game, n, line);
+		}
+	}
+	spin_unlock(&device_data_lock);
+	if (new) {
+		atomic_dec(&history_pages);
+		__free_page(new);
+	}
+	return page;
+}
+
+/** lines of history mm_history_read_iter() renders per hold of device_data_lock */
+#define MM_HISTORY_READ_LINES 16
+
+/**
+ * mm_history_read_iter() - callback invoked when a process reads from
+ * /dev/mm_history
+ * @iocb: I/O control block of the read
+ * @to: destination of the read
+ *
+ * Copy the caller's user view, as mm_mmap() maps it, from @iocb->ki_pos
+ * on: one USER_VIEW_LINE_SIZE record per guess, NUL-padded, followed by
+ * a record announcing the win if the game was won. A single read can
+ * return the whole history; a read at or past its end returns 0. The
+ * read stops early if the game is restarted meanwhile, so that it never
+ * mixes the histories of two games.
+ *
+ * Only the caller's per-user game is served. A game owned by an open
+ * file of /dev/mm under per_file_games cannot be named through another
+ * file, so its history is only available by mmap() of that file.
+ *
+ * Return: number of bytes copied, 0 at end of history, or negative on
+ * error
+ */
+static ssize_t mm_history_read_iter(struct kiocb *iocb, struct iov_iter *to)
+{
+	char lines[MM_HISTORY_READ_LINES][USER_VIEW_LINE_SIZE];
+	struct mm_game *game;
+	loff_t pos = iocb->ki_pos;
+	size_t size = 0, len, copied, total = 0;
+	u64 start_seq = 0;
+	unsigned n, i;
+
+	if (pos < 0)
+		return -EINVAL;
+	game = mm_find_game(current_cred()->uid);
+	if (IS_ERR(game))
+		return PTR_ERR(game);
+	while (iov_iter_count(to)) {
+		spin_lock(&device_data_lock);
+		if (total && game->start_seq != start_seq) {
+			spin_unlock(&device_data_lock);
+			break;
+		}
+		start_seq = game->start_seq;
+		size = game->user_view_size;
+		if (pos >= size) {
+			spin_unlock(&device_data_lock);
+			break;
+		}
+		n = pos / USER_VIEW_LINE_SIZE;
+		for (i = 0; i < MM_HISTORY_READ_LINES && (size_t)(n + i) * USER_VIEW_LINE_SIZE < size; i++)
+			mm_user_view_line(game, n + i, lines[i]);
+		spin_unlock(&device_data_lock);
+
+		len = (size_t)i * USER_VIEW_LINE_SIZE - pos % USER_VIEW_LINE_SIZE;
+		copied = copy_to_iter(lines[0] + pos % USER_VIEW_LINE_SIZE, len, to);
+		pos += copied;
+		total += copied;
+		if (copied < len)
+			break;
+	}
+	mm_put_game(game);
+	if (!total && iov_iter_count(to) && pos < size)
+		return -EFAULT;
+	iocb->ki_pos = pos;
+	return total;
+}
+
+/**
+ * mm_guess_record() - record a scored guess at @game
+ * @game: referenced game being played
+ * @guess: NUM_PEGS ASCII digits
+ * @correct_place_guesses: number of black pegs @guess scored
+ * @correct_value_guesses: number of white pegs @guess scored
+ * @file: open /dev/mm to remember the result in for mm_read(), or %NULL
+ *
+ * Caller must hold device_data_lock.
+ */
+static void mm_guess_record(struct mm_game *game, const char *guess,
+			    unsigned correct_place_guesses,
+			    unsigned correct_value_guesses, struct mm_file *file)
+{
+	struct mm_guess_record rec;
+	bool stored;
+
+	game->last_result[1] = '0' + correct_place_guesses;
+	game->last_result[3] = '0' + correct_value_guesses;
+	game->num_guesses++;
+	memcpy(rec.guess, guess, NUM_PEGS);
+	rec.black = correct_place_guesses;
+	rec.white = correct_value_guesses;
+	stored = game->history_len < MM_HISTORY_MAX;
+	if (stored)
+		game->history[game->history_len++] = rec;
+	if (game->track_candidates && game->candidate_view)
+	{
+		mm_candidates_update(game);
+		if (!stored)
+			mm_candidates_filter(game, &rec);
+	}
+	mm_user_view_sync(game);
+	if (file)
+	{
+		file->result_seq = game->start_seq;
+		memcpy(file->last_result, game->last_result, NUM_PEGS);
+	}
+	if(correct_place_guesses == 4){
+		if (!game->bench)
+			mm_player_won(game);
+		mm_end_game(game);
+	}
+	else
+		mm_game_changed(game);
+}
+
+/**
+ * mm_guess_locked() - score a guess against @game and record it
+ * @game: referenced game the guess applies to
+ * @guess: NUM_PEGS ASCII digits
+ * @black: set to the number of pegs of the right color in the right place
+ * @white: set to the number of further pegs of the right color
+ * @file: open /dev/mm to remember the result in for mm_read(), or %NULL
+ *
+ * Caller must hold device_data_lock.
+ *
+ * Return: 0 on success, -EINVAL if @game is not being played
+ */
+static int mm_guess_locked(struct mm_game *game, const char *guess, unsigned *black,
+			   unsigned *white, struct mm_file *file)
+{
+	int user_guess[NUM_PEGS];
+	size_t i;
+
+	if (!game->game_active)
+	{
+		return -EINVAL;
+	}
+	for (i = 0; i < NUM_PEGS; i++)
+	{
+		user_guess[i] = guess[i] - '0';
+	}
+	mm_arena_sync(game, mm_score(game, user_guess, black, white));
+	mm_guess_record(game, guess, *black, *white, file);
+	return 0;
+}
+
+/**
+ * mm_guess_prescored_locked() - record a guess scored by
+ * mm_arena_prescore()
+ * @game: referenced game the guess applies to
+ * @guess: NUM_PEGS ASCII digits
+ * @score: MM_SCORE() of @guess
+ * @ps: as filled in by mm_arena_prescore()
+ * @black: set to the number of pegs of the right color in the right place
+ * @white: set to the number of further pegs of the right color
+ * @file: open /dev/mm to remember the result in for mm_read(), or %NULL
+ *
+ * If @game is no longer the arena game that was scored against, the
+ * guess is scored again by mm_guess_locked().
+ *
+ * Caller must hold device_data_lock.
+ *
+ * Return: 0 on success, -EINVAL if @game is not being played
+ */
+static int mm_guess_prescored_locked(struct mm_game *game, const char *guess, u8 score,
+				     const struct mm_arena_prescore *ps, unsigned *black,
+				     unsigned *white, struct mm_file *file)
+{
+	if (!ps->seq || !game->arena || !game->game_active ||
+	    game->start_seq != ps->start_seq)
+		return mm_guess_locked(game, guess, black, white, file);
+	mm_arena_sync(game, ps->seq);
+	*black = MM_SCORE_BLACK(score);
+	*white = MM_SCORE_WHITE(score);
+	mm_guess_record(game, guess, *black, *white, file);
+	return 0;
+}
+
+/**
+ * mm_guess() - score a guess against @game and record it
+ *
+ * Like mm_guess_locked(), but the caller must not hold
+ * device_data_lock. Guesses at arena games are scored before taking it.
+ */
+static int mm_guess(struct mm_game *game, const char *guess, unsigned *black,
+		    unsigned *white, struct mm_file *file)
+{
+	struct mm_arena_prescore ps;
+	int retval;
+	u8 score;
+
+	mm_arena_prescore(game, guess, 1, &score, &ps);
+	spin_lock(&device_data_lock);
+	retval = mm_guess_prescored_locked(game, guess, score, &ps, black, white, file);
+	spin_unlock(&device_data_lock);
+	return retval;
+}
+
+/**
+ * mm_write_game() - score a guess written to /dev/mm against @game
+ * @game: referenced game the guess applies to
+ * @file: open file the guess was written to
+ * @ubuf: source buffer from user
+ * @count: number of bytes in @ubuf
+ *
+ * Return: @count, or negative on error
+ */
+static ssize_t mm_write_game(struct mm_game *game, struct mm_file *file,
+			     const char __user *ubuf, size_t count)
+{
+	char temp_array[NUM_PEGS];
+	unsigned black, white;
+	int retval;
+
+	if (!game->game_active || count < NUM_PEGS)
+		return -EINVAL;
+	if (copy_from_user(temp_array, ubuf, NUM_PEGS))
+		return -EFAULT;
+	retval = mm_guess(game, temp_array, &black, &white, file);
+	if (retval)
+		return retval;
+	return count;
+}
+
+/**
+ * mm_write() - callback invoked when a process writes to /dev/mm
+ * @filp: process's file object that is writing to this device
+ * @ubuf: source buffer from user
+ * @count: number of bytes in @ubuf
+ * @ppos: file offset (ignored)
+ *
+ * If the user is not currently playing a game, then return -EINVAL.
+ *
+ * If @count is less than NUM_PEGS, then return -EINVAL. Otherwise,
+ * interpret the first NUM_PEGS characters in @ubuf as the user's
+ * guess. Calculate how many are in the correct value and position,
+ * and how many are simply the correct value. Then update
+ * @num_guesses, @last_result, and @user_view.
+ *
+ * <em>Caution: @ubuf is NOT a string; it is not necessarily
+ * null-terminated.</em> You CANNOT use strcpy() or strlen() on it!
+ *
+ * If the guess_rate parameter is set and the user has used up their
+ * guesses for now, return -EAGAIN.
+ *
+ * Return: @count, or negative on error
+ */
+static ssize_t
+mm_write(struct file *filp, const char __user *ubuf,
+		 size_t count, loff_t *ppos)
+{
+	struct mm_game * game;
+	ssize_t retval;
+	if (!mm_rate_take(current_cred()->uid, 1))
+		return -EAGAIN;
+	game = mm_file_game(filp);
+	if (IS_ERR(game))
+		return PTR_ERR(game);
+	retval = mm_write_game(game, filp->private_data, ubuf, count);
+	mm_put_game(game);
+	return retval;
+}
+
+/**
+ * mm_write_iter() - callback invoked for vectored writes to /dev/mm,
+ * such as writev(), io_uring and splice
+ * @iocb: I/O control block of the write
+ * @from: data to write
+ *
+ * Each segment of @from is treated like one write() to /dev/mm: its
+ * first NUM_PEGS bytes are a guess. Guesses are copied in batches of
+ * up to MM_GUESS_BATCH and recorded under a single lock hold; those at
+ * an arena game are scored before it. Scoring
+ * stops at the first segment that is too short, once the game is over,
+ * or once the user runs out of guesses under guess_rate.
+ *
+ * Return: number of bytes in the segments scored, or negative if the
+ * first one could not be
+ */
+static ssize_t mm_write_iter(struct kiocb *iocb, struct iov_iter *from)
+{
+	struct file *filp = iocb->ki_filp;
+	struct mm_game *game = mm_file_game(filp);
+	char guesses[MM_GUESS_BATCH][NUM_PEGS];
+	size_t lengths[MM_GUESS_BATCH];
+	u8 scores[MM_GUESS_BATCH];
+	struct mm_arena_prescore ps;
+	size_t length, done = 0;
+	unsigned black, white;
+	unsigned n, i;
+	int retval = 0;
+
+	if (IS_ERR(game))
+		return PTR_ERR(game);
+	while (!retval && iov_iter_count(from)) {
+		for (n = 0; n < MM_GUESS_BATCH && iov_iter_count(from); n++) {
+			length = iov_iter_single_seg_count(from);
+			if (length < NUM_PEGS) {
+				retval = -EINVAL;
+				break;
+			}
+			if (copy_from_iter(guesses[n], NUM_PEGS, from) != NUM_PEGS) {
+				retval = -EFAULT;
+				break;
+			}
+			iov_iter_advance(from, length - NUM_PEGS);
+			lengths[n] = length;
+		}
+		i = mm_rate_take(current_cred()->uid, n);
+		if (i < n) {
+			n = i;
+			retval = -EAGAIN;
+		}
+		mm_arena_prescore(game, guesses[0], n, scores, &ps);
+		spin_lock(&device_data_lock);
+		for (i = 0; i < n; i++) {
+			if (mm_guess_prescored_locked(game, guesses[i], scores[i], &ps,
+						      &black, &white, filp->private_data)) {
+				retval = -EINVAL;
+				break;
+			}
+			done += lengths[i];
+		}
+		spin_unlock(&device_data_lock);
+	}
+	mm_put_game(game);
+	return done ? done : retval;
+}
+
+static void mm_scores_vma_open(struct vm_area_struct *vma)
+{
+	struct mm_score_table *table = vma->vm_private_data;
+
+	kref_get(&table->ref);
+}
+
+static void mm_scores_vma_close(struct vm_area_struct *vma)
+{
+	mm_score_table_put(vma->vm_private_data);
+}
+
+static const struct vm_operations_struct mm_scores_vm_ops = {
+	.open = mm_scores_vma_open,
+	.close = mm_scores_vma_close,
+};
+
+static void mm_game_vma_open(struct vm_area_struct *vma)
+{
+	struct mm_game *game = vma->vm_private_data;
+
+	kref_get(&game->ref);
+}
+
+static void mm_game_vma_close(struct vm_area_struct *vma)
+{
+	mm_put_game(vma->vm_private_data);
+}
+
+/* keeps a reclaimed or evicted game's pages until they are unmapped */
+static const struct vm_operations_struct mm_game_vm_ops = {
+	.open = mm_game_vma_open,
+	.close = mm_game_vma_close,
+};
+
+static void mm_user_view_vma_open(struct vm_area_struct *vma)
+{
+	struct mm_game *game = vma->vm_private_data;
+
+	spin_lock(&device_data_lock);
+	kref_get(&game->ref);
+	game->user_view_maps++;
+	spin_unlock(&device_data_lock);
+}
+
+static void mm_user_view_vma_close(struct vm_area_struct *vma)
+{
+	struct mm_game *game = vma->vm_private_data;
+
+	spin_lock(&device_data_lock);
+	game->user_view_maps--;
+	spin_unlock(&device_data_lock);
+	mm_put_game(game);
+}
+
+/**
+ * mm_user_view_fault() - map one page of a game's user view,
+ * rendering it from history first if it does not exist
+ *
+ * Only touched pages are allocated. The game is reached through the
+ * mapping, without looking it up again, and its pages cannot be
+ * dropped while the mapping exists.
+ */
+static vm_fault_t mm_user_view_fault(struct vm_fault *vmf)
+{
+	struct mm_game *game = vmf->vma->vm_private_data;
+	struct page *page;
+
+	if (vmf->pgoff >= MM_USER_VIEW_PAGES)
+		return VM_FAULT_SIGBUS;
+	page = mm_user_view_populate(game, vmf->pgoff);
+	if (IS_ERR(page))
+		return PTR_ERR(page) == -ENOMEM ? VM_FAULT_OOM : VM_FAULT_SIGBUS;
+	get_page(page);
+	vmf->page = page;
+	return 0;
+}
+
+static const struct vm_operations_struct mm_user_view_vm_ops = {
+	.open = mm_user_view_vma_open,
+	.close = mm_user_view_vma_close,
+	.fault = mm_user_view_fault,
+};
+
+/**
+ * mm_mmap_scores() - map the score table for @game's board read-only
+ * @game: caller's game
+ * @vma: virtual memory allocation object containing mmap() request
+ *
+ * Uses the table of the game's own board, or of the current number of
+ * colors if the game was never started, waiting for it to be built if
+ * needed. The mapping keeps the table alive after the game moves on.
+ *
+ * Return: 0 on success, negative on error.
+ */
+static int mm_mmap_scores(struct mm_game *game, struct vm_area_struct *vma)
+{
+	struct mm_score_table *table;
+	bool retried = false;
+	int colors = NUM_COLORS;
+	int retval;
+
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+	for (;;) {
+		spin_lock(&device_data_lock);
+		table = game->scores;
+		if (table) {
+			kref_get(&table->ref);
+		} else {
+			colors = game->colors ? game->colors : NUM_COLORS;
+			table = mm_score_table_get(colors);
+		}
+		spin_unlock(&device_data_lock);
+		if (table || retried)
+			break;
+		if (!score_tables || mm_code_space(colors) > MM_SCORE_TABLE_MAX_SPACE)
+			return -ENODEV;
+		flush_work(&score_table_work);
+		retried = true;
+	}
+	if (!table)
+		return -EAGAIN;
+
+	vma->vm_flags &= ~VM_MAYWRITE;
+	retval = remap_vmalloc_range(vma, table->scores, 0);
+	if (retval) {
+		mm_score_table_put(table);
+		return retval;
+	}
+	vma->vm_private_data = table;
+	vma->vm_ops = &mm_scores_vm_ops;
+	return 0;
+}
+
+/**
+ * mm_mmap_user_view() - map part of @game's user view read-only
+ * @game: caller's game, whose reference passes to the mapping on success
+ * @vma: virtual memory allocation object containing mmap() request
+ *
+ * Any range of the MM_USER_VIEW_PAGES pages may be mapped; each page
+ * is filled in by mm_user_view_fault() when first touched.
+ *
+ * Return: 0 on success, negative on error.
+ */
+static int mm_mmap_user_view(struct mm_game *game, struct vm_area_struct *vma)
+{
+	if (vma->vm_pgoff >= MM_USER_VIEW_PAGES)
+		return -EINVAL;
+	if (vma_pages(vma) > MM_USER_VIEW_PAGES - vma->vm_pgoff)
+		return -EIO;
+	if ((vma->vm_flags & (VM_SHARED | VM_WRITE)) == (VM_SHARED | VM_WRITE))
+		return -EPERM;
+	if (vma->vm_flags & VM_SHARED)
+		vma->vm_flags &= ~VM_MAYWRITE;
+	vma->vm_flags |= VM_DONTEXPAND | VM_DONTDUMP;
+	vma->vm_private_data = game;
+	vma->vm_ops = &mm_user_view_vm_ops;
+	spin_lock(&device_data_lock);
+	game->user_view_maps++;
+	spin_unlock(&device_data_lock);
+	return 0;
+}
+
+/**
+ * mm_mmap() - callback invoked when a process mmap()s to /dev/mm
+ * @filp: process's file object that is mapping to this device
+ * @vma: virtual memory allocation object containing mmap() request
+ *
+ * Create a read-only mapping from kernel memory (specifically,
+ * @user_view) into user space. The user view spans
+ * MM_USER_VIEW_PAGES pages; mmap() any of them by page offset. Pages
+ * are mapped when first touched, rebuilding them from the game's
+ * history if the shrinker dropped them. At page offset
+ * MM_MMAP_CANDIDATES_PGOFF, map the game's struct mm_candidate_view
+ * instead; unless the track_candidates parameter was set when the
+ * game started, that view is only refreshed by mmap() and
+ * MM_IOC_SOLVE. At MM_MMAP_SCORES_PGOFF, map the shared score table.
+ *
+ * Code based upon
+ * <a href="http://bloggar.combitech.se/ldc/2015/01/21/mmap-memory-between-kernel-and-userspace/">http://bloggar.combitech.se/ldc/2015/01/21/mmap-memory-between-kernel-and-userspace/</a>
+ *
+ * You do not need to modify this function.
+ *
+ * Return: 0 on success, negative on error.
+ */
+static int mm_mmap(struct file *filp, struct vm_area_struct *vma)
+{
+
+	struct mm_game * game = mm_file_game(filp);
+	unsigned long size = (unsigned long)(vma->vm_end - vma->vm_start);
+	unsigned long page;
+	int retval;
+	if (IS_ERR(game))
+		return PTR_ERR(game);
+	if (vma->vm_pgoff == MM_MMAP_SCORES_PGOFF)
+	{
+		retval = mm_mmap_scores(game, vma);
+		goto out;
+	}
+	if (vma->vm_pgoff == MM_MMAP_CANDIDATES_PGOFF)
+	{
+		retval = mm_candidates_prepare(game);
+		if (retval)
+			goto out;
+		spin_lock(&device_data_lock);
+		mm_candidates_update(game);
+		spin_unlock(&device_data_lock);
+		page = vmalloc_to_pfn(game->candidate_view);
+	}
+	else
+	{
+		retval = mm_mmap_user_view(game, vma);
+		if (retval)
+			goto out;
+		/* the mapping inherits our reference */
+		return 0;
+	}
+	retval = -EIO;
+	if (size > PAGE_SIZE)
+		goto out;
+	vma->vm_pgoff = 0;
+	vma->vm_page_prot = PAGE_READONLY;
+	retval = -EAGAIN;
+	if (remap_pfn_range(vma, vma->vm_start, page, size, vma->vm_page_prot))
+		goto out;
+	/* the mapping inherits our reference */
+	vma->vm_private_data = game;
+	vma->vm_ops = &mm_game_vm_ops;
+	return 0;
+out:
+	mm_put_game(game);
+	return retval;
+}
+
+/**
+ * mm_pick_guess() - choose a next guess from a candidate bitmap
+ * @candidates: codes consistent with the history so far
+ * @space: number of bits in @candidates
+ * @colors: number of colors on the board
+ * @remaining: number of set bits in @candidates
+ * @guess: *OUT* parameter, NUM_PEGS peg values
+ *
+ * With no information yet, open with the first two colors doubled up
+ * (Knuth's 1122). Once at most MM_SOLVE_MINIMAX_MAX candidates remain,
+ * pick the candidate whose worst-case feedback partition is smallest.
+ * Otherwise fall back to the first consistent code.
+ */
+static void mm_pick_guess(const unsigned long *candidates, unsigned space,
+			  int colors, unsigned remaining, int guess[])
+{
+	unsigned buckets[(NUM_PEGS + 1) * (NUM_PEGS + 1)];
+	u16 *codes;
+	unsigned n, g, c, worst, best_worst;
+	unsigned long bit;
+	int a[NUM_PEGS], b[NUM_PEGS];
+	unsigned black, white;
+	size_t i;
+
+	if (remaining == space) {
+		for (i = 0; i < NUM_PEGS; i++)
+			guess[i] = (i < NUM_PEGS / 2) ? 0 : 1;
+		return;
+	}
+	codes = NULL;
+	if (remaining <= MM_SOLVE_MINIMAX_MAX)
+		codes = kmalloc_array(remaining, sizeof(*codes), GFP_KERNEL);
+	if (!codes) {
+		mm_index_to_code(find_first_bit(candidates, space), colors, guess);
+		return;
+	}
+
+	n = 0;
+	for_each_set_bit(bit, candidates, space)
+		codes[n++] = bit;
+	best_worst = UINT_MAX;
+	for (g = 0; g < n; g++) {
+		mm_index_to_code(codes[g], colors, a);
+		memset(buckets, 0, sizeof(buckets));
+		worst = 0;
+		for (c = 0; c < n; c++) {
+			mm_index_to_code(codes[c], colors, b);
+			mm_num_pegs(b, a, &black, &white);
+			i = black * (NUM_PEGS + 1) + white;
+			if (++buckets[i] > worst)
+				worst = buckets[i];
+		}
+		if (worst < best_worst) {
+			best_worst = worst;
+			memcpy(guess, a, sizeof(a));
+		}
+		cond_resched();
+	}
+	kfree(codes);
+}
+
+/**
+ * mm_solve() - compute the remaining candidate count and a suggested
+ * next guess for @game
+ * @game: game to solve
+ * @result: *OUT* parameter to store the answer
+ *
+ * The candidate bitmap is narrowed incrementally under the lock; the
+ * guess is then chosen from a private copy so that the search does
+ * not hold up other players.
+ *
+ * Return: 0 on success, negative on error
+ */
+static int mm_solve(struct mm_game *game, struct mm_solve *result)
+{
+	unsigned long *snapshot;
+	unsigned space;
+	int colors;
+	int guess[NUM_PEGS];
+	size_t i;
+	int retval;
+
+	retval = mm_candidates_prepare(game);
+	if (retval)
+		return retval;
+	snapshot = bitmap_zalloc(mm_code_space(MM_MAX_COLORS), GFP_KERNEL);
+	if (!snapshot)
+		return -ENOMEM;
+
+	spin_lock(&device_data_lock);
+	if (!game->game_active) {
+		spin_unlock(&device_data_lock);
+		bitmap_free(snapshot);
+		return -EINVAL;
+	}
+	mm_candidates_update(game);
+	colors = game->colors;
+	space = game->candidate_view->space;
+	result->space = space;
+	result->remaining = game->candidate_view->remaining;
+	memcpy(snapshot, game->candidate_view->bits,
+	       DIV_ROUND_UP(space, 64) * sizeof(game->candidate_view->bits[0]));
+	spin_unlock(&device_data_lock);
+
+	if (result->remaining) {
+		mm_pick_guess(snapshot, space, colors, result->remaining, guess);
+		for (i = 0; i < NUM_PEGS; i++)
+			result->guess[i] = '0' + guess[i];
+	} else {
+		memset(result->guess, '?', NUM_PEGS);
+	}
+	bitmap_free(snapshot);
+	return 0;
+}
+
+/**
+ * mm_start_game() - start a new game on @game, restarting it if it is
+ * in progress
+ * @game: referenced game to start
+ * @colors: number of colors on the board, or 0 for NUM_COLORS
+ *
+ * Caller must not hold device_data_lock.
+ */
+static void mm_start_game(struct mm_game *game, int colors)
+{
+	if (track_candidates)
+		mm_candidates_prepare(game);
+	spin_lock(&device_data_lock);
+	initialize_game(game, colors ? colors : NUM_COLORS);
+	spin_unlock(&device_data_lock);
+}
+
+/**
+ * mm_join_arena() - start a new game on @game against the arena code
+ * @game: referenced game to start
+ *
+ * The game is played on the arena code's board and follows every later
+ * change of the arena code.
+ *
+ * Caller must not hold device_data_lock.
+ */
+static void mm_join_arena(struct mm_game *game)
+{
+	struct mm_arena_code *arena;
+
+	if (track_candidates)
+		mm_candidates_prepare(game);
+	spin_lock(&device_data_lock);
+	rcu_read_lock();
+	arena = rcu_dereference(arena_code);
+	initialize_game(game, arena->colors);
+	game->arena_seq = arena->seq;
+	rcu_read_unlock();
+	game->arena = true;
+	spin_unlock(&device_data_lock);
+}
+
+/**
+ * mm_set_colors() - change the number of colors for new games
+ * @colors: new number of colors
+ *
+ * Return: 0 on success, -EACCES without CAP_SYS_ADMIN, -EINVAL if
+ * @colors is out of range
+ */
+static int mm_set_colors(int colors)
+{
+	if (!capable(CAP_SYS_ADMIN))
+		return -EACCES;
+	if (colors < 2 || colors > MM_MAX_COLORS)
+		return -EINVAL;
+	spin_lock(&device_data_lock);
+	if (colors != NUM_COLORS)
+	{
+		/* the old table goes once no game uses it */
+		NUM_COLORS = colors;
+		mm_score_table_request(colors);
+	}
+	spin_unlock(&device_data_lock);
+	return 0;
+}
+
+/**
+ * mm_game_ioctl() - carry out an ioctl() on @game
+ * @game: referenced game the command applies to
+ * @cmd: ioctl command, one of the MM_IOC_* values in mastermind2.h
+ * @arg: user pointer to the command's argument
+ *
+ *  MM_IOC_SOLVE      - store a struct mm_solve describing @game
+ *  MM_IOC_START      - start @game on the board given by a struct mm_start
+ *  MM_IOC_QUIT       - quit @game
+ *  MM_IOC_SET_COLORS - change the number of colors for new games
+ *  MM_IOC_GET_STATE  - store a struct mm_state describing @game
+ *  MM_IOC_GUESS      - score the guess in a struct mm_guess and store
+ *                      the result in it
+ *
+ * Return: 0 on success, negative on error
+ */
+static long mm_game_ioctl(struct mm_game *game, unsigned int cmd, unsigned long arg)
+{
+	void __user *uarg = (void __user *)arg;
+	struct mm_solve solve;
+	struct mm_start start;
+	struct mm_state state;
+	struct mm_guess guess;
+	unsigned black, white;
+	u32 colors;
+	int retval;
+
+	switch (cmd) {
+	case MM_IOC_SOLVE:
+		memset(&solve, 0, sizeof(solve));
+		retval = mm_solve(game, &solve);
+		if (!retval && copy_to_user(uarg, &solve, sizeof(solve)))
+			retval = -EFAULT;
+		return retval;
+	case MM_IOC_START:
+		if (copy_from_user(&start, uarg, sizeof(start)))
+			return -EFAULT;
+		if (start.reserved || start.colors == 1 || start.colors > MM_MAX_COLORS)
+			return -EINVAL;
+		mm_start_game(game, start.colors);
+		return 0;
+	case MM_IOC_QUIT:
+		spin_lock(&device_data_lock);
+		mm_end_game(game);
+		spin_unlock(&device_data_lock);
+		return 0;
+	case MM_IOC_SET_COLORS:
+		if (get_user(colors, (u32 __user *)uarg))
+			return -EFAULT;
+		return mm_set_colors(min_t(u32, colors, INT_MAX));
+	case MM_IOC_GET_STATE:
+		memset(&state, 0, sizeof(state));
+		spin_lock(&device_data_lock);
+		state.active = game->game_active;
+		state.colors = game->colors;
+		state.num_guesses = game->num_guesses;
+		state.history_len = game->history_len;
+		if (game->game_active)
+			memcpy(state.last_result, game->last_result, NUM_PEGS);
+		else
+			memcpy(state.last_result, "????", NUM_PEGS);
+		spin_unlock(&device_data_lock);
+		if (copy_to_user(uarg, &state, sizeof(state)))
+			return -EFAULT;
+		return 0;
+	case MM_IOC_GUESS:
+		if (copy_from_user(&guess, uarg, sizeof(guess)))
+			return -EFAULT;
+		if (guess.reserved[0] || guess.reserved[1])
+			return -EINVAL;
+		if (!mm_rate_take(current_cred()->uid, 1))
+			return -EAGAIN;
+		retval = mm_guess(game, guess.guess, &black, &white, NULL);
+		if (retval)
+			return retval;
+		guess.black = black;
+		guess.white = white;
+		if (copy_to_user(uarg, &guess, sizeof(guess)))
+			return -EFAULT;
+		return 0;
+	default:
+		return -ENOTTY;
+	}
+}
+
+/**
+ * mm_ioctl() - callback invoked when a process issues an ioctl() on
+ * /dev/mm
+ * @filp: process's file object
+ * @cmd: ioctl command, one of the MM_IOC_* values in mastermind2.h
+ * @arg: user pointer to the command's argument
+ *
+ * MM_IOC_FOLLOW sets how reads past the result of @filp behave, see
+ * mm_read(). For the other commands see mm_game_ioctl(); they act on
+ * the same game as read() and write() would.
+ *
+ * Return: 0 on success, negative on error
+ */
+static long mm_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+{
+	struct mm_file *file = filp->private_data;
+	struct mm_game *game;
+	long retval;
+	u32 follow;
+
+	if (cmd == MM_IOC_FOLLOW) {
+		if (get_user(follow, (u32 __user *)arg))
+			return -EFAULT;
+		WRITE_ONCE(file->follow, follow != 0);
+		return 0;
+	}
+	game = mm_file_game(filp);
+	if (IS_ERR(game))
+		return PTR_ERR(game);
+	retval = mm_game_ioctl(game, cmd, arg);
+	mm_put_game(game);
+	return retval;
+}
+
+/**
+ * mm_open() - callback invoked when a process opens /dev/mm
+ * @inode: device inode (ignored)
+ * @filp: process's file object
+ *
+ * If the per_file_games parameter is set, create and start a game
+ * owned by @filp alone; a process may then play many games at once by
+ * opening /dev/mm several times. Otherwise operations on @filp act on
+ * the caller's per-user game.
+ *
+ * Return: 0 on success, negative on error
+ */
+static int mm_open(struct inode *inode, struct file *filp)
+{
+	struct mm_file *file;
+	struct mm_game *game;
+
+	file = kzalloc(sizeof(*file), GFP_KERNEL);
+	if (!file)
+		return -ENOMEM;
+	INIT_LIST_HEAD(&file->watch);
+	init_waitqueue_head(&file->waitq);
+	filp->private_data = file;
+	/* reads past the result honour IOCB_NOWAIT, see mm_read_iter() */
+	filp->f_mode |= FMODE_NOWAIT;
+	if (!per_file_games)
+		return 0;
+
+	game = mm_alloc_game(current_cred()->uid);
+	if (!game) {
+		kfree(file);
+		return -ENOMEM;
+	}
+	game->per_file = true;
+	if (track_candidates)
+		mm_candidates_prepare(game);
+	spin_lock(&device_data_lock);
+	initialize_game(game, NUM_COLORS);
+	list_add_tail(&game->list, &game_list);
+	file->game = game;
+	list_add_tail(&file->watch, &game->watchers);
+	spin_unlock(&device_data_lock);
+	return 0;
+}
+
+/**
+ * mm_release() - callback invoked when the last reference to an open
+ * /dev/mm file is dropped
+ * @inode: device inode (ignored)
+ * @filp: process's file object
+ *
+ * End and drop the game owned by @filp, if any, or drop the per-user
+ * game it remembered. Mappings of a game's pages hold their own
+ * reference and keep it alive until unmapped.
+ *
+ * Return: always 0
+ */
+static int mm_release(struct inode *inode, struct file *filp)
+{
+	struct mm_file *file = filp->private_data;
+	struct mm_game *game = file->game;
+
+	spin_lock(&device_data_lock);
+	list_del(&file->watch);
+	if (game && game->per_file) {
+		mm_end_game(game);
+		list_del_init(&game->list);
+	}
+	spin_unlock(&device_data_lock);
+	kfree(file);
+	if (game)
+		mm_put_game(game);
+	return 0;
+}
+
+/**
+ * mm_ctl_command() - run one /dev/mm_ctl text command
+ * @gamep: caller's game, looked up on first use; release with
+ * mm_put_game() if set on return
+ * @temp_array: the command, @count bytes followed by room for a NUL
+ * @count: length of the command
+ *
+ * See mm_ctl_write() for the commands.
+ *
+ * Return: 0 on success, negative on error
+ */
+static int mm_ctl_command(struct mm_game **gamep, char *temp_array, size_t count)
+{
+	struct mm_game *game;
+	size_t temp_length = count;
+	int colors;
+
+	if (temp_length > 0 && temp_array[temp_length - 1] == '\n')
+	{
+		temp_length--;
+	}
+	temp_array[temp_length] = '\0';
+
+	if (temp_length > 7 && compare_strings(temp_array, 7, "colors ", 7))
+	{
+		if (!capable(CAP_SYS_ADMIN))
+			return -EACCES;
+		if (kstrtoint(temp_array + 7, 10, &colors))
+			return -EINVAL;
+		return mm_set_colors(colors);
+	}
+
+	if (!compare_strings(temp_array, temp_length, "start", 5) &&
+	    !compare_strings(temp_array, temp_length, "arena", 5) &&
+	    !compare_strings(temp_array, temp_length, "quit", 4))
+	{
+		return -EINVAL;
+	}
+	if (!*gamep)
+	{
+		game = mm_find_game(current_cred()->uid);
+		if (IS_ERR(game))
+		{
+			return PTR_ERR(game);
+		}
+		*gamep = game;
+	}
+	if (temp_array[0] == 's')
+	{
+		mm_start_game(*gamep, 0);
+	}
+	else if (temp_array[0] == 'a')
+	{
+		mm_join_arena(*gamep);
+	}
+	else
+	{
+		spin_lock(&device_data_lock);
+		mm_end_game(*gamep);
+		spin_unlock(&device_data_lock);
+	}
+	return 0;
 }
 
 /**
@@ -435,14 +3135,22 @@ static int mm_mmap(struct file *filp, struct vm_area_struct *vma)
  * @count: number of bytes in @ubuf
  * @ppos: file offset (ignored)
  *
- * Copy the contents of @ubuf, up to the lesser of @count and 8 bytes,
- * to a temporary location. Then parse that character array as
- * following:
+ * Copy the contents of @ubuf, which must be shorter than 16 bytes, to
+ * a temporary location. Then parse that character array, minus one
+ * trailing newline, as following:
  *
- *  start - Start a new game. If a game was already in progress, restart it.
- *  quit  - Quit the current game. If no game was in progress, do nothing.
+ *  start    - Start a new game. If a game was already in progress, restart it.
+ *  arena    - Like start, but play against the code shared by all
+ *             arena games, which network code changes replace at once.
+ *  quit     - Quit the current game. If no game was in progress, do nothing.
+ *  colors N - Set the number of colors for new games (CAP_SYS_ADMIN only).
  *
- * If the input is neither of the above, then return -EINVAL.
+ * If the input is none of the above, then return -EINVAL. The
+ * MM_IOC_* ioctls offer the same commands without text parsing.
+ *
+ * These commands act on the caller's per-user game. Games created
+ * through the per_file_games parameter are restarted by opening
+ * /dev/mm again.
  *
  * <em>Caution: @ubuf is NOT a string;</em> it is not necessarily
  * null-terminated, nor does it necessarily have a trailing
@@ -453,61 +3161,525 @@ static int mm_mmap(struct file *filp, struct vm_area_struct *vma)
 static ssize_t mm_ctl_write(struct file *filp, const char __user *ubuf,
 							size_t count, loff_t *ppos)
 {
-	struct mm_game * game = mm_find_game(current_cred()->uid);
-	char temp_array[8];
-	size_t temp_length;
-	size_t i;
-	int length_copied;
+	struct mm_game *game = NULL;
+	char temp_array[MM_CTL_COMMAND_MAX];
+	int retval;
 
-	for (i = 0; i < 8; i++)
+	if (count >= sizeof(temp_array))
 	{
-		temp_array[i] = 0;
+		return -EINVAL;
 	}
-	
-	temp_length = 8;
-	if (count < 8)
+	if (copy_from_user(temp_array, ubuf, count))
 	{
-		temp_length = count;
+		return -EFAULT;
 	}
+	retval = mm_ctl_command(&game, temp_array, count);
+	if (game)
+		mm_put_game(game);
+	return retval ? retval : count;
+}
 
-	length_copied = copy_from_user(temp_array, ubuf, temp_length);
-	spin_lock(&device_data_lock);
+/**
+ * mm_ctl_write_iter() - callback invoked for vectored writes to
+ * /dev/mm_ctl, such as writev() and io_uring
+ * @iocb: I/O control block of the write
+ * @from: commands to run
+ *
+ * Each segment of @from is one command, as if passed to
+ * mm_ctl_write(). The caller's game is looked up once for all of
+ * them. Processing stops at the first command that fails.
+ *
+ * Return: number of bytes in the commands run, or negative if the
+ * first one failed
+ */
+static ssize_t mm_ctl_write_iter(struct kiocb *iocb, struct iov_iter *from)
+{
+	struct mm_game *game = NULL;
+	char temp_array[MM_CTL_COMMAND_MAX];
+	size_t length, done = 0;
+	int retval = 0;
 
-	if (compare_strings(temp_array, temp_length, "start", 5))
-	{
-		initialize_game(game);
+	while (iov_iter_count(from)) {
+		length = iov_iter_single_seg_count(from);
+		if (length >= sizeof(temp_array)) {
+			retval = -EINVAL;
+			break;
+		}
+		if (copy_from_iter(temp_array, length, from) != length) {
+			retval = -EFAULT;
+			break;
+		}
+		retval = mm_ctl_command(&game, temp_array, length);
+		if (retval)
+			break;
+		done += length;
 	}
-	else if (compare_strings(temp_array, temp_length, "quit", 4))
-	{
-		game->game_active = false;
+	if (game)
+		mm_put_game(game);
+	return done ? done : retval;
+}
+
+/**
+ * mm_ctl_ioctl() - callback invoked when a process issues an ioctl()
+ * on /dev/mm_ctl
+ * @filp: process's file object (ignored)
+ * @cmd: ioctl command, one of the MM_IOC_* values in mastermind2.h
+ * @arg: user pointer to the command's argument
+ *
+ * See mm_game_ioctl(); commands act on the caller's per-user game.
+ *
+ * Return: 0 on success, negative on error
+ */
+static long mm_ctl_ioctl(struct file *filp, unsigned int cmd, unsigned long arg)
+{
+	struct mm_game *game = mm_find_game(current_cred()->uid);
+	long retval;
+
+	if (IS_ERR(game))
+		return PTR_ERR(game);
+	retval = mm_game_ioctl(game, cmd, arg);
+	mm_put_game(game);
+	return retval;
+}
+
+/**
+ * mm_snapshot_size() - number of bytes a snapshot of the registry takes
+ *
+ * Games owned by open files die with their files and are left out.
+ *
+ * Caller must hold device_data_lock.
+ */
+static size_t mm_snapshot_size(void)
+{
+	struct mm_game *game;
+	size_t size = sizeof(struct mm_snapshot_header);
+
+	list_for_each_entry(game, &game_list, list) {
+		if (game->per_file)
+			continue;
+		size += sizeof(struct mm_snapshot_game) +
+			game->history_len * sizeof(struct mm_snapshot_guess);
+	}
+	return size;
+}
+
+/**
+ * mm_snapshot_fill() - serialize the registry
+ * @buf: destination of mm_snapshot_size() bytes
+ *
+ * Records are packed without padding, so they are assembled on the
+ * stack and copied into place.
+ *
+ * Caller must hold device_data_lock.
+ */
+static void mm_snapshot_fill(u8 *buf)
+{
+	struct mm_snapshot_header hdr;
+	struct mm_snapshot_game rec;
+	struct mm_snapshot_guess guess;
+	struct mm_game *game;
+	u8 *pos = buf + sizeof(hdr);
+	int target[NUM_PEGS];
+	unsigned i;
+
+	memset(&hdr, 0, sizeof(hdr));
+	hdr.magic = MM_SNAPSHOT_MAGIC;
+	hdr.version = MM_SNAPSHOT_VERSION;
+	hdr.colors = NUM_COLORS;
+	hdr.games_started = games_started;
+	hdr.codes_changed = codes_changed;
+	hdr.invalid_attempts = invalid_attempts;
+	list_for_each_entry(game, &game_list, list) {
+		if (game->per_file)
+			continue;
+		memset(&rec, 0, sizeof(rec));
+		rec.uid = from_kuid_munged(&init_user_ns, game->uid);
+		rec.num_guesses = game->num_guesses;
+		rec.history_len = game->history_len;
+		rec.active = game->game_active;
+		rec.colors = game->colors;
+		mm_game_target(game, target);
+		for (i = 0; i < NUM_PEGS; i++)
+			rec.target[i] = target[i];
+		memcpy(rec.last_result, game->last_result, NUM_PEGS);
+		memcpy(pos, &rec, sizeof(rec));
+		pos += sizeof(rec);
+		for (i = 0; i < game->history_len; i++) {
+			memcpy(guess.guess, game->history[i].guess, NUM_PEGS);
+			guess.black = game->history[i].black;
+			guess.white = game->history[i].white;
+			memcpy(pos, &guess, sizeof(guess));
+			pos += sizeof(guess);
+		}
+		hdr.num_games++;
 	}
-	else if (compare_strings(temp_array, 6, "colors", 6)){
-		if (!capable(CAP_SYS_ADMIN)){
+	memcpy(buf, &hdr, sizeof(hdr));
+}
+
+/**
+ * mm_snapshot_build() - serialize the registry into a new buffer
+ * @len: set to the length of the snapshot
+ *
+ * The snapshot is taken in one pass under device_data_lock, so it is
+ * consistent.
+ *
+ * Return: vmalloc()ed snapshot, or %NULL if out of memory
+ */
+static u8 *mm_snapshot_build(size_t *len)
+{
+	u8 *buf = NULL;
+	size_t size, capacity = 0;
+
+	for (;;) {
+		spin_lock(&device_data_lock);
+		size = mm_snapshot_size();
+		if (buf && size <= capacity) {
+			mm_snapshot_fill(buf);
 			spin_unlock(&device_data_lock);
-			return -EACCES;
+			*len = size;
+			return buf;
 		}
-		else{
-			int colors = temp_array[7] - 48;
-			if (colors >= 2 && colors <= 9){
-				NUM_COLORS = colors;	
-			}
-			else
-			{
-				spin_unlock(&device_data_lock);
-				return -EINVAL;
-			}
-			
+		spin_unlock(&device_data_lock);
+		vfree(buf);
+		/* leave room for games started in the meantime */
+		capacity = size + size / 8;
+		buf = vmalloc(capacity);
+		if (!buf)
+			return NULL;
+	}
+}
+
+/**
+ * mm_snapshot_check_game() - validate one game record of a snapshot
+ *
+ * Return: 0 if @rec could have been written by mm_snapshot_fill()
+ */
+static int mm_snapshot_check_game(const struct mm_snapshot_game *rec)
+{
+	unsigned i;
+
+	if (!uid_valid(make_kuid(&init_user_ns, rec->uid)) ||
+	    rec->history_len > MM_HISTORY_MAX || rec->num_guesses < rec->history_len ||
+	    rec->active > 1 || rec->colors < 2 || rec->colors > MM_MAX_COLORS ||
+	    rec->last_result[0] != 'B' || rec->last_result[2] != 'W' ||
+	    rec->reserved[0] || rec->reserved[1])
+		return -EINVAL;
+	for (i = 0; i < NUM_PEGS; i++)
+		if (rec->target[i] > 9)
+			return -EINVAL;
+	return 0;
+}
+
+/**
+ * mm_snapshot_load_game() - fill a new game from its snapshot records
+ * @game: game from mm_alloc_game(), not yet on game_list
+ * @rec: game record
+ * @guesses: @rec->history_len packed guess records
+ *
+ * Return: 0 on success, -EINVAL if a guess record is malformed
+ */
+static int mm_snapshot_load_game(struct mm_game *game, const struct mm_snapshot_game *rec,
+				 const u8 *guesses)
+{
+	struct mm_snapshot_guess guess;
+	unsigned i;
+
+	for (i = 0; i < rec->history_len; i++) {
+		memcpy(&guess, guesses + i * sizeof(guess), sizeof(guess));
+		if (guess.black + guess.white > NUM_PEGS)
+			return -EINVAL;
+		memcpy(game->history[i].guess, guess.guess, NUM_PEGS);
+		game->history[i].black = guess.black;
+		game->history[i].white = guess.white;
+	}
+	game->history_len = rec->history_len;
+	game->num_guesses = rec->num_guesses;
+	game->game_active = rec->active;
+	game->colors = rec->colors;
+	for (i = 0; i < NUM_PEGS; i++)
+		game->target_code[i] = rec->target[i];
+	game->target_index = mm_code_to_index(game->target_code, game->colors);
+	memcpy(game->last_result, rec->last_result, NUM_PEGS);
+	game->candidates_stale = true;
+	game->track_candidates = track_candidates;
+	mm_user_view_sync(game);
+	return 0;
+}
+
+static int mm_snapshot_cmp_uid(const void *a, const void *b)
+{
+	kuid_t uid_a = (*(struct mm_game * const *)a)->uid;
+	kuid_t uid_b = (*(struct mm_game * const *)b)->uid;
+
+	if (uid_lt(uid_a, uid_b))
+		return -1;
+	return uid_gt(uid_a, uid_b);
+}
+
+/**
+ * mm_snapshot_restore() - replace games with those of a snapshot
+ * @data: snapshot as read from /dev/mm_snapshot
+ * @len: length of @data
+ *
+ * The whole snapshot is validated and its games allocated before
+ * anything is changed. Each restored game replaces the game of the
+ * same user, if any; other games are left alone. The games are
+ * sorted by user so that matching them against the registry stays
+ * O(n log n) for large snapshots. The statistics and
+ * number of colors are set to those of the snapshot.
+ *
+ * Return: number of games restored, or negative on error; a snapshot
+ * listing a user twice is rejected
+ */
+static int mm_snapshot_restore(const u8 *data, size_t len)
+{
+	struct mm_snapshot_header hdr;
+	struct mm_snapshot_game rec;
+	struct mm_game **games = NULL;
+	struct mm_game *game, *old, *tmp;
+	LIST_HEAD(victims);
+	size_t pos;
+	unsigned i, n;
+	int retval = -EINVAL;
+
+	if (len < sizeof(hdr))
+		return -EINVAL;
+	memcpy(&hdr, data, sizeof(hdr));
+	if (hdr.magic != MM_SNAPSHOT_MAGIC || hdr.version != MM_SNAPSHOT_VERSION ||
+	    hdr.reserved || hdr.colors < 2 || hdr.colors > MM_MAX_COLORS ||
+	    hdr.num_games > (len - sizeof(hdr)) / sizeof(rec))
+		return -EINVAL;
+	if (hdr.num_games) {
+		games = kvmalloc_array(hdr.num_games, sizeof(*games), GFP_KERNEL | __GFP_ZERO);
+		if (!games)
+			return -ENOMEM;
+	}
+
+	pos = sizeof(hdr);
+	for (n = 0; n < hdr.num_games; n++) {
+		if (len - pos < sizeof(rec))
+			goto out;
+		memcpy(&rec, data + pos, sizeof(rec));
+		pos += sizeof(rec);
+		if (mm_snapshot_check_game(&rec) ||
+		    len - pos < rec.history_len * sizeof(struct mm_snapshot_guess))
+			goto out;
+		games[n] = mm_alloc_game(make_kuid(&init_user_ns, rec.uid));
+		if (!games[n]) {
+			retval = -ENOMEM;
+			goto out;
 		}
+		if (mm_snapshot_load_game(games[n], &rec, data + pos))
+			goto out;
+		pos += rec.history_len * sizeof(struct mm_snapshot_guess);
+	}
+	if (pos != len)
+		goto out;
+	sort(games, n, sizeof(*games), mm_snapshot_cmp_uid, NULL);
+	for (i = 1; i < n; i++)
+		if (uid_eq(games[i - 1]->uid, games[i]->uid))
+			goto out;
+
+	spin_lock(&device_data_lock);
+	list_for_each_entry_safe(old, tmp, &game_list, list) {
+		if (old->per_file || !n ||
+		    !bsearch(&old, games, n, sizeof(*games), mm_snapshot_cmp_uid))
+			continue;
+		list_move_tail(&old->list, &victims);
+		mm_unregister_game(old);
+	}
+	for (i = 0; i < n; i++) {
+		game = games[i];
+		game->scores = mm_score_table_get(game->colors);
+		game->last_used = jiffies;
+		/* no file has a result of this start, as for initialize_game() */
+		game->start_seq = ++games_start_seq;
+		game->code_seq = fanout_seq;
+		if (game->game_active)
+			games_active++;
+		list_add_tail(&game->list, &game_list);
+		game->registered = true;
+		games_allocated++;
+		games[i] = NULL;
+	}
+	if (hdr.colors != NUM_COLORS) {
+		NUM_COLORS = hdr.colors;
+		mm_score_table_request(NUM_COLORS);
 	}
+	games_started = hdr.games_started;
+	codes_changed = hdr.codes_changed;
+	invalid_attempts = hdr.invalid_attempts;
 	spin_unlock(&device_data_lock);
+	retval = n;
+
+	list_for_each_entry_safe(game, tmp, &victims, list) {
+		list_del_init(&game->list);
+		mm_put_game(game);
+	}
+out:
+	for (i = 0; i < hdr.num_games; i++)
+		if (games[i])
+			mm_put_game(games[i]);
+	kvfree(games);
+	return retval;
+}
+
+/**
+ * struct mm_snapshot_file - state of an open /dev/mm_snapshot
+ * @data: snapshot taken at open, or the image written so far
+ * @len: number of valid bytes at @data
+ * @capacity: allocated size of @data
+ * @restored: whether the written image was already restored
+ */
+struct mm_snapshot_file {
+	u8 *data;
+	size_t len;
+	size_t capacity;
+	bool restored;
+};
+
+/**
+ * mm_snapshot_open() - callback invoked when a process opens
+ * /dev/mm_snapshot
+ * @inode: device inode (ignored)
+ * @filp: process's file object
+ *
+ * Opening for reading takes a snapshot of every per-user game and the
+ * statistics; read() then streams it. Opening for writing collects an
+ * image that is restored when the file is closed. Only
+ * CAP_SYS_ADMIN may do either.
+ *
+ * Return: 0 on success, negative on error
+ */
+static int mm_snapshot_open(struct inode *inode, struct file *filp)
+{
+	struct mm_snapshot_file *snap;
+
+	if (!capable(CAP_SYS_ADMIN))
+		return -EACCES;
+	if ((filp->f_mode & FMODE_READ) && (filp->f_mode & FMODE_WRITE))
+		return -EINVAL;
+	snap = kzalloc(sizeof(*snap), GFP_KERNEL);
+	if (!snap)
+		return -ENOMEM;
+	if (filp->f_mode & FMODE_READ) {
+		snap->data = mm_snapshot_build(&snap->len);
+		if (!snap->data) {
+			kfree(snap);
+			return -ENOMEM;
+		}
+	}
+	filp->private_data = snap;
+	return 0;
+}
+
+static ssize_t mm_snapshot_read(struct file *filp, char __user *ubuf,
+				size_t count, loff_t *ppos)
+{
+	struct mm_snapshot_file *snap = filp->private_data;
+
+	return simple_read_from_buffer(ubuf, count, ppos, snap->data, snap->len);
+}
+
+/**
+ * mm_snapshot_write() - store part of a snapshot image at @ppos
+ *
+ * Return: @count, or negative on error
+ */
+static ssize_t mm_snapshot_write(struct file *filp, const char __user *ubuf,
+				 size_t count, loff_t *ppos)
+{
+	struct mm_snapshot_file *snap = filp->private_data;
+	size_t capacity;
+	u8 *data;
+
+	if (*ppos < 0 || *ppos > MM_SNAPSHOT_MAX || count > MM_SNAPSHOT_MAX - *ppos)
+		return -EFBIG;
+	if (*ppos + count > snap->capacity) {
+		capacity = max_t(size_t, *ppos + count, 2 * snap->capacity);
+		capacity = min_t(size_t, capacity, MM_SNAPSHOT_MAX);
+		data = vzalloc(capacity);
+		if (!data)
+			return -ENOMEM;
+		if (snap->data)
+			memcpy(data, snap->data, snap->len);
+		vfree(snap->data);
+		snap->data = data;
+		snap->capacity = capacity;
+	}
+	if (copy_from_user(snap->data + *ppos, ubuf, count))
+		return -EFAULT;
+	*ppos += count;
+	snap->len = max_t(size_t, snap->len, *ppos);
 	return count;
 }
 
+/**
+ * mm_snapshot_flush() - restore the image written to @filp when it is
+ * closed, so that errors reach close()
+ */
+static int mm_snapshot_flush(struct file *filp, fl_owner_t id)
+{
+	struct mm_snapshot_file *snap = filp->private_data;
+	int retval;
+
+	if (!(filp->f_mode & FMODE_WRITE) || snap->restored || !snap->len)
+		return 0;
+	snap->restored = true;
+	retval = mm_snapshot_restore(snap->data, snap->len);
+	if (retval < 0)
+		return retval;
+	pr_info("Restored %d games\n", retval);
+	return 0;
+}
+
+static int mm_snapshot_release(struct inode *inode, struct file *filp)
+{
+	struct mm_snapshot_file *snap = filp->private_data;
+
+	vfree(snap->data);
+	kfree(snap);
+	return 0;
+}
+
+/**
+ * mm_snapshot_load_firmware() - restore the snapshot named by the
+ * restore_snapshot parameter, if any
+ * @dev: device requesting the firmware
+ */
+static void mm_snapshot_load_firmware(struct device *dev)
+{
+	const struct firmware *fw;
+	int retval;
+
+	if (!restore_snapshot || !*restore_snapshot)
+		return;
+	retval = request_firmware_direct(&fw, restore_snapshot, dev);
+	if (retval) {
+		pr_warn("Could not load snapshot %s: %d\n", restore_snapshot, retval);
+		return;
+	}
+	retval = mm_snapshot_restore(fw->data, fw->size);
+	if (retval < 0)
+		pr_warn("Could not restore snapshot %s: %d\n", restore_snapshot, retval);
+	else
+		pr_info("Restored %d games from %s\n", retval, restore_snapshot);
+	release_firmware(fw);
+}
+
 /** strcut to handle call backs to dev/mm */
 static const struct file_operations mm_operations = {
+	.owner = THIS_MODULE,
+	.open = mm_open,
+	.release = mm_release,
 	.read = mm_read,
 	.write = mm_write,
+	.read_iter = mm_read_iter,
+	.write_iter = mm_write_iter,
+	.poll = mm_poll,
 	.mmap = mm_mmap,
+	.unlocked_ioctl = mm_ioctl,
+	.compat_ioctl = compat_ptr_ioctl,
 };
 
 static struct miscdevice mastermind_device = {
@@ -519,107 +3691,241 @@ static struct miscdevice mastermind_device = {
 
 /** strcut to handle call backs to dev/mm _ctl*/
 static const struct file_operations mm_ctl_operations = {
+	.owner = THIS_MODULE,
 	.write = mm_ctl_write,
+	.write_iter = mm_ctl_write_iter,
+	.unlocked_ioctl = mm_ctl_ioctl,
+	.compat_ioctl = compat_ptr_ioctl,
+};
+
+static struct miscdevice mastermind_ctl_device = {
+	.minor = MISC_DYNAMIC_MINOR,
+	.name = "mm_ctl",
+	.fops = &mm_ctl_operations,
+	.mode = 0666,
+};
+
+static const struct file_operations mm_history_operations = {
+	.owner = THIS_MODULE,
+	.read_iter = mm_history_read_iter,
+	.llseek = no_seek_end_llseek,
+};
+
+static struct miscdevice mastermind_history_device = {
+	.minor = MISC_DYNAMIC_MINOR,
+	.name = "mm_history",
+	.fops = &mm_history_operations,
+	.mode = 0444,
+};
+
+static const struct file_operations mm_snapshot_operations = {
+	.owner = THIS_MODULE,
+	.open = mm_snapshot_open,
+	.read = mm_snapshot_read,
+	.write = mm_snapshot_write,
+	.flush = mm_snapshot_flush,
+	.release = mm_snapshot_release,
+	.llseek = default_llseek,
 };
 
-static struct miscdevice mastermind_ctl_device = {
-	.minor = MISC_DYNAMIC_MINOR,
-	.name = "mm_ctl",
-	.fops = &mm_ctl_operations,
-	.mode = 0666,
-};
+static struct miscdevice mastermind_snapshot_device = {
+	.minor = MISC_DYNAMIC_MINOR,
+	.name = "mm_snapshot",
+	.fops = &mm_snapshot_operations,
+	.mode = 0600,
+};
+
+/**
+ * cs421net_top() - top-half of CS421Net ISR
+ * @irq: IRQ that was invoked (ignored)
+ * @cookie: Pointer to data that was passed into
+ * request_threaded_irq() (ignored)
+ *
+ * If @irq is CS421NET_IRQ, then wake up the bottom-half. Otherwise,
+ * return IRQ_NONE.
+ */
+static irqreturn_t cs421net_top(int irq, void *cookie)
+{
+	/* Part 4: YOUR CODE HERE */
+	if(irq == CS421NET_IRQ){
+		return IRQ_WAKE_THREAD;
+	}else
+	{
+		return IRQ_NONE;
+	}
+}
+
+/**
+ * mm_game_new_code() - give @game a new target code
+ * @game: the game
+ * @code: NUM_PEGS peg values
+ *
+ * Not for arena games, which follow arena_code through mm_arena_sync().
+ *
+ * Caller must hold device_data_lock.
+ */
+static void mm_game_new_code(struct mm_game *game, const int code[])
+{
+	memcpy(game->target_code, code, sizeof(game->target_code));
+	game->target_index = mm_code_to_index(game->target_code, game->colors);
+	/* earlier feedback was against the old code */
+	game->candidates_applied = game->history_len;
+	game->candidates_stale = true;
+	mm_game_changed(game);
+}
+
+/**
+ * mm_fanout_work_func() - give the latest network code to every game
+ *
+ * The shards are swept one after another, each under its own lock.
+ * Game targets are protected by device_data_lock, so sweeping shards on
+ * several CPUs at once would only take turns on it; instead the lock is
+ * dropped every MM_FANOUT_BATCH games, so players wait for at most one
+ * batch rather than for every game. A code arriving mid-sweep queues the
+ * work again; games that already have it are skipped then, as are arena
+ * and self-benchmark games.
+ */
+static void mm_fanout_work_func(struct work_struct *work)
+{
+	struct mm_shard *shard;
+	struct mm_game *game;
+	unsigned long seq;
+	unsigned n = 0;
+	int cpu;
+
+	spin_lock(&device_data_lock);
+	seq = fanout_seq;
+	spin_unlock(&device_data_lock);
+	for_each_possible_cpu(cpu) {
+		shard = per_cpu_ptr(&mm_shards, cpu);
+		spin_lock(&shard->lock);
+		spin_lock(&device_data_lock);
+		list_for_each_entry(game, &shard->games, shard_node) {
+			/* arena games catch up in mm_arena_sync() instead */
+			if (!game->arena && !game->bench && game->code_seq != fanout_seq) {
+				mm_game_new_code(game, fanout_code);
+				game->code_seq = fanout_seq;
+			}
+			if (++n % MM_FANOUT_BATCH == 0) {
+				spin_unlock(&device_data_lock);
+				spin_lock(&device_data_lock);
+			}
+		}
+		spin_unlock(&device_data_lock);
+		spin_unlock(&shard->lock);
+	}
+	/* games started since had the code already */
+	WRITE_ONCE(fanout_done_seq, seq);
+}
+
+static DECLARE_WORK(mm_fanout_work, mm_fanout_work_func);
 
 /**
- * cs421net_top() - top-half of CS421Net ISR
- * @irq: IRQ that was invoked (ignored)
- * @cookie: Pointer to data that was passed into
- * request_threaded_irq() (ignored)
- *
- * If @irq is CS421NET_IRQ, then wake up the bottom-half. Otherwise,
- * return IRQ_NONE.
+ * mm_shards_init() - set up the per-CPU game lists
  */
-static irqreturn_t cs421net_top(int irq, void *cookie)
+static void mm_shards_init(void)
 {
-	printk("Inside the top function.");
-	/* Part 4: YOUR CODE HERE */
-	if(irq == CS421NET_IRQ){
-		printk("IRQ matched, calling bottom by returning value.");
-		return IRQ_WAKE_THREAD;
-	}else
-	{
-		printk("IRQ did not match.");
-		return IRQ_NONE;
+	struct mm_shard *shard;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		shard = per_cpu_ptr(&mm_shards, cpu);
+		spin_lock_init(&shard->lock);
+		INIT_LIST_HEAD(&shard->games);
 	}
 }
 
 /**
- * cs421net_bottom() - bottom-half to CS421Net ISR
- * @irq: IRQ that was invoked (ignore)
- * @cookie: Pointer that was passed into request_threaded_irq()
- * (ignored)
+ * mm_net_code() - handle one payload from CS421Net
+ * @data: the payload
+ * @len: length of @data
  *
- * Fetch the incoming packet, via cs421net_get_data(). If:
+ * If:
  *   1. The packet length is exactly equal to four bytes, and
  *   2. If all characters in the packet are valid ASCII representation
  *      of valid digits in the code, then
- * Set the target code to the new code, and increment the number of
- * tymes the code was changed remotely. Otherwise, ignore the packet
- * and increment the number of invalid change attempts.
- *
- * Because the payload is dynamically allocated, free it after parsing
- * it.
- *
- * During Part 5, update this function to change all codes for all
- * active games.
- *
- * Remember to add appropriate spin lock calls in this function.
+ * Set the target code of all games to the new code, and increment the
+ * number of tymes the code was changed remotely. Otherwise, ignore the
+ * packet and increment the number of invalid change attempts.
  *
  * <em>Caution: The incoming payload is NOT a string; it is not
  * necessarily null-terminated.</em> You CANNOT use strcpy() or
  * strlen() on it!
- *
- * Return: always IRQ_HANDLED
  */
-static irqreturn_t cs421net_bottom(int irq, void *cookie)
+static void mm_net_code(const char *data, size_t len)
 {
+	int code[NUM_PEGS];
 	bool valid_data;
 	size_t i;
-	struct list_head *pos;
-	struct mm_game *temp;
-	size_t returned_data_size;
-	char * data;
-	/* Part 4: YOUR CODE HERE */
-	valid_data = true;
-	temp = NULL;
-	data = cs421net_get_data(&returned_data_size);
-	valid_data = (returned_data_size == 4);
-	for ( i = 0; i < 4 && valid_data; i++)
+
+	valid_data = (len == NUM_PEGS);
+	for ( i = 0; i < NUM_PEGS && valid_data; i++)
 	{
-		if(data[i] < 48 || data[i] > 57){
+		if(data[i] < '0' || data[i] >= '0' + NUM_COLORS){
 			valid_data = false;
 		}
 	}
 	if(valid_data){
-		printk("Data is valid.");
-		printk("Data is: %c%c%c%c", data[0], data[1], data[2], data[3]);
+		pr_debug("New code: %c%c%c%c\n", data[0], data[1], data[2], data[3]);
 		spin_lock(&device_data_lock);
-		for (pos = game_list.next; pos != &game_list; pos = pos->next)
+		for (i = 0; i < NUM_PEGS; i++)
 		{
-			temp = list_entry(pos, struct mm_game, list);
-			printk("Changing target for process with id: %d", temp->uid.val);
-			 for (i = 0; i < 4; i++)
-			 {
-				 temp->target_code[i] = data[i];
-			 }
+			code[i] = data[i] - '0';
+			fanout_code[i] = code[i];
 		}
-		spin_unlock(&device_data_lock);
+		fanout_seq++;
 		codes_changed++;
+		spin_unlock(&device_data_lock);
+		if (mm_arena_publish(code, NUM_COLORS))
+			pr_warn("Could not change the arena code\n");
+		queue_work(system_highpri_wq, &mm_fanout_work);
 	}
 	else
 	{
-		printk("Data is invalid.");
+		pr_debug("Invalid code change of length %zu\n", len);
+		spin_lock(&device_data_lock);
 		invalid_attempts++;
+		spin_unlock(&device_data_lock);
 	}
+}
+
+/**
+ * mm_net_consume() - CS421Net consumer callback, see
+ * cs421net_register_consumer()
+ * @data: the payload
+ * @len: length of @data
+ * @priv: ignored
+ */
+static void mm_net_consume(const char *data, size_t len, void *priv)
+{
+	mm_net_code(data, len);
+}
+
+/**
+ * cs421net_bottom() - bottom-half to CS421Net ISR
+ * @irq: IRQ that was invoked (ignore)
+ * @cookie: Pointer that was passed into request_threaded_irq()
+ * (ignored)
+ *
+ * Fetch the incoming packet, via cs421net_get_data(), and pass it to
+ * mm_net_code(). Only used with the net_irq parameter; otherwise
+ * packets arrive through mm_net_consume() without the interrupt.
+ *
+ * Because the payload is dynamically allocated, free it after parsing
+ * it.
+ *
+ * Return: always IRQ_HANDLED
+ */
+static irqreturn_t cs421net_bottom(int irq, void *cookie)
+{
+	size_t returned_data_size;
+	char * data;
+	/* Part 4: YOUR CODE HERE */
+	data = cs421net_get_data(&returned_data_size);
+	if (!data)
+		return IRQ_HANDLED;
+	mm_net_code(data, returned_data_size);
+	kfree(data);
 	return IRQ_HANDLED;
 }
 
@@ -638,6 +3944,9 @@ static irqreturn_t cs421net_bottom(int irq, void *cookie)
  *   - Number of active games
  *   - Number of valid network messages (see Part 4)
  *   - Number of invalid network messages (see Part 4)
+ *   - Number of games and history pages held, and how many games
+ *     were freed for being idle or over max_games/max_history_pages
+ *   - Number of user view pages dropped by the shrinker
  * Note that @buf is a normal character buffer, not a __user
  * buffer. Use scnprintf() in this function.
  *
@@ -647,58 +3956,567 @@ static ssize_t mm_stats_show(struct device *dev,
 			     struct device_attribute *attr, char *buf)
 {
 	/* Part 3: YOUR CODE HERE */
-	char * message_to_write;
-	char *temp_number_array;
-	size_t temp_array_size;
+	return scnprintf(buf, PAGE_SIZE,
+			 "Number of colors: %d\n"
+			 "Number of started games: %d\n"
+			 "Number of active games: %d\n"
+			 "Number of times code was changed: %d\n"
+			 "Number of invalid code change attempts: %d\n"
+			 "Number of games in memory: %u\n"
+			 "Number of history pages: %d\n"
+			 "Number of idle games reclaimed: %lu\n"
+			 "Number of games evicted by limits: %lu\n"
+			 "Number of user view pages dropped under memory pressure: %lu\n"
+			 "Number of code changes given to every game: %lu\n"
+			 "Number of guesses refused by rate limits: %ld\n",
+			 NUM_COLORS, games_started, games_active,
+			 codes_changed, invalid_attempts,
+			 READ_ONCE(games_allocated), atomic_read(&history_pages),
+			 READ_ONCE(games_reclaimed), READ_ONCE(games_evicted),
+			 READ_ONCE(views_shrunk), READ_ONCE(fanout_done_seq),
+			 atomic_long_read(&guesses_throttled));
+}
+
+static DEVICE_ATTR(stats, S_IRUGO, mm_stats_show, NULL);
+
+/**
+ * mm_leaderboard_show() - callback invoked when a process reads from
+ * /sys/devices/platform/mastermind/leaderboard
+ * @dev: device driver data for sysfs entry (ignored)
+ * @attr: sysfs entry context (ignored)
+ * @buf: destination to store leaderboard
+ *
+ * List the leaderboard_size users with the fewest guesses in a won
+ * game, one per line: rank, uid, that number of guesses, games won,
+ * games started, and average guesses per won game. Only the listed
+ * players are visited.
+ *
+ * Return: number of bytes written to @buf
+ */
+static ssize_t mm_leaderboard_show(struct device *dev,
+				   struct device_attribute *attr, char *buf)
+{
+	unsigned limit = READ_ONCE(leaderboard_size);
+	struct mm_player *player;
+	struct rb_node *node;
+	unsigned rank = 0, average;
+	ssize_t len;
+
+	len = scnprintf(buf, PAGE_SIZE, "rank uid best wins games average\n");
+	spin_lock(&device_data_lock);
+	for (node = rb_first(&players_by_rank); node && rank < limit; node = rb_next(node)) {
+		player = rb_entry(node, struct mm_player, by_rank);
+		average = div_u64(player->win_guesses * 100, player->wins);
+		len += scnprintf(buf + len, PAGE_SIZE - len, "%u %u %u %u %u %u.%02u\n",
+				 ++rank, from_kuid_munged(&init_user_ns, player->uid),
+				 player->best, player->wins, player->games,
+				 average / 100, average % 100);
+	}
+	spin_unlock(&device_data_lock);
+	return len;
+}
+
+static DEVICE_ATTR(leaderboard, S_IRUGO, mm_leaderboard_show, NULL);
+
+/** debugfs directory of the module */
+static struct dentry *mm_debugfs;
+
+/**
+ * struct mm_games_iter - position of a reader of the games debugfs file
+ * @cpu: CPU whose shard lock is held between start and stop, or -1
+ * @game: game at @pos, referenced between reads so that the next read
+ * resumes from it instead of walking all games before it, or %NULL
+ * @game_cpu: CPU of @game's shard
+ * @pos: seq_file position of the last game returned
+ */
+struct mm_games_iter {
+	int cpu;
+	struct mm_game *game;
+	int game_cpu;
+	loff_t pos;
+};
+
+/**
+ * mm_games_walk() - find a game in the shards, moving on to the next
+ * shard's lock whenever one runs out
+ * @iter: iterator, holding the lock of shard @iter->cpu
+ * @node: shard_node to start after, or the shard's list head
+ * @skip: number of games to pass over
+ *
+ * Return: the game, with its shard's lock held, or %NULL with no lock held
+ */
+static struct mm_game *mm_games_walk(struct mm_games_iter *iter,
+				     struct list_head *node, loff_t skip)
+{
+	struct mm_shard *shard = per_cpu_ptr(&mm_shards, iter->cpu);
+
+	for (;;) {
+		node = node->next;
+		if (node == &shard->games) {
+			spin_unlock(&shard->lock);
+			iter->cpu = cpumask_next(iter->cpu, cpu_possible_mask);
+			if (iter->cpu >= nr_cpu_ids) {
+				iter->cpu = -1;
+				return NULL;
+			}
+			shard = per_cpu_ptr(&mm_shards, iter->cpu);
+			spin_lock(&shard->lock);
+			node = &shard->games;
+		} else if (skip-- == 0)
+			return list_entry(node, struct mm_game, shard_node);
+	}
+}
+
+/**
+ * mm_games_first() - find a game counting from the first shard
+ * @iter: iterator, holding no lock
+ * @skip: number of games to pass over
+ */
+static struct mm_game *mm_games_first(struct mm_games_iter *iter, loff_t skip)
+{
+	struct mm_shard *shard;
+
+	iter->cpu = cpumask_first(cpu_possible_mask);
+	shard = per_cpu_ptr(&mm_shards, iter->cpu);
+	spin_lock(&shard->lock);
+	return mm_games_walk(iter, &shard->games, skip);
+}
+
+static void *mm_games_start(struct seq_file *m, loff_t *pos)
+{
+	struct mm_games_iter *iter = m->private;
+	struct mm_game *game;
+
+	iter->cpu = -1;
+	if (!*pos)
+		return SEQ_START_TOKEN;
+	if (iter->game && iter->pos == *pos) {
+		/* referenced, so still on its shard */
+		iter->cpu = iter->game_cpu;
+		spin_lock(&per_cpu_ptr(&mm_shards, iter->cpu)->lock);
+		return iter->game;
+	}
+	game = mm_games_first(iter, *pos - 1);
+	if (game)
+		iter->pos = *pos;
+	return game;
+}
+
+static void *mm_games_next(struct seq_file *m, void *v, loff_t *pos)
+{
+	struct mm_games_iter *iter = m->private;
+	struct mm_game *game;
+
+	++*pos;
+	if (v == SEQ_START_TOKEN)
+		game = mm_games_first(iter, 0);
+	else
+		game = mm_games_walk(iter, &((struct mm_game *)v)->shard_node, 0);
+	if (game)
+		iter->pos = *pos;
+	return game;
+}
+
+static void mm_games_stop(struct seq_file *m, void *v)
+{
+	struct mm_games_iter *iter = m->private;
+	struct mm_game *old = iter->game;
+
+	iter->game = NULL;
+	if (v && v != SEQ_START_TOKEN &&
+	    kref_get_unless_zero(&((struct mm_game *)v)->ref)) {
+		iter->game = v;
+		iter->game_cpu = iter->cpu;
+	}
+	if (iter->cpu >= 0)
+		spin_unlock(&per_cpu_ptr(&mm_shards, iter->cpu)->lock);
+	iter->cpu = -1;
+	/* mm_free_game() takes the shard lock */
+	if (old)
+		mm_put_game(old);
+}
+
+static int mm_games_show(struct seq_file *m, void *v)
+{
+	struct mm_game *game = v;
+	char last_result[sizeof(game->last_result)];
+	unsigned num_guesses;
+	const char *kind;
+	bool active;
+	int colors;
+
+	if (v == SEQ_START_TOKEN) {
+		seq_puts(m, "uid kind active colors guesses last_result\n");
+		return 0;
+	}
+	spin_lock(&device_data_lock);
+	if (!uid_valid(game->uid))
+		kind = "bench";
+	else if (game->arena)
+		kind = "arena";
+	else if (game->per_file)
+		kind = "file";
+	else if (game->registered)
+		kind = "user";
+	else
+		kind = "evicted";
+	active = game->game_active;
+	colors = game->colors;
+	num_guesses = game->num_guesses;
+	memcpy(last_result, game->last_result, sizeof(last_result));
+	spin_unlock(&device_data_lock);
+	seq_printf(m, "%u %s %d %d %u %.4s\n",
+		   from_kuid_munged(seq_user_ns(m), game->uid), kind, active,
+		   colors, num_guesses, num_guesses ? last_result : "----");
+	return 0;
+}
+
+static const struct seq_operations mm_games_seq_ops = {
+	.start = mm_games_start,
+	.next = mm_games_next,
+	.stop = mm_games_stop,
+	.show = mm_games_show,
+};
+
+static int mm_games_open(struct inode *inode, struct file *filp)
+{
+	return seq_open_private(filp, &mm_games_seq_ops, sizeof(struct mm_games_iter));
+}
+
+static int mm_games_release(struct inode *inode, struct file *filp)
+{
+	struct mm_games_iter *iter = ((struct seq_file *)filp->private_data)->private;
+
+	if (iter->game)
+		mm_put_game(iter->game);
+	return seq_release_private(inode, filp);
+}
+
+/*
+ * debugfs file listing every game, one per line, shard by shard. Only
+ * one shard's lock is held at a time, and only for as long as it takes
+ * to fill one buffer, so that a dump of many games never stalls play
+ * for long.
+ */
+static const struct file_operations mm_games_fops = {
+	.owner = THIS_MODULE,
+	.open = mm_games_open,
+	.read = seq_read,
+	.llseek = seq_lseek,
+	.release = mm_games_release,
+};
+
+/**
+ * struct mm_bench_player - one kthread of a self-benchmark
+ * @task: the kthread
+ * @broadcaster: whether it broadcasts code changes rather than plays
+ * @game: game it plays, allocated on its own CPU, or %NULL
+ * @cpu: CPU it is bound to
+ * @ops: guesses scored, or code changes broadcast
+ * @starts: games it started after winning one
+ * @locks: acquisitions of device_data_lock to score a guess
+ * @contended: those that found the lock held
+ * @wait_ns: time spent spinning on the contended ones
+ */
+struct mm_bench_player {
+	struct task_struct *task;
+	bool broadcaster;
+	struct mm_game *game;
+	int cpu;
+	u64 ops;
+	u64 starts;
+	u64 locks;
+	u64 contended;
+	u64 wait_ns;
+};
+
+/* one self-benchmark at a time, and its report */
+static DEFINE_MUTEX(mm_bench_mutex);
+static char mm_bench_report[PAGE_SIZE];
+static size_t mm_bench_report_len;
+/* completed once every player kthread exists, so that all start together */
+static DECLARE_COMPLETION(mm_bench_go);
+/* kthreads yet to allocate their game, and completed when none are */
+static atomic_t mm_bench_pending;
+static DECLARE_COMPLETION(mm_bench_ready);
+/* players of the running self-benchmark, for its broadcaster */
+static struct mm_bench_player *mm_bench_players;
+static unsigned mm_bench_nplayers;
+
+/**
+ * mm_bench_code() - the @n'th code of the board, as ASCII digits
+ */
+static void mm_bench_code(char code[], unsigned long n)
+{
 	size_t i;
-	ssize_t buffer_size;
-	loff_t current_message_buffer_pointer;
-	current_message_buffer_pointer = 0;
-	buffer_size = 0;
-	message_to_write = vmalloc(PAGE_SIZE);
-	for (i = 0; i < PAGE_SIZE; i++)
-	{
-		message_to_write[i] = 0;
+
+	for (i = 0; i < NUM_PEGS; i++) {
+		code[i] = '0' + n % NUM_COLORS;
+		n /= NUM_COLORS;
+	}
+}
+
+/**
+ * mm_bench_lock() - take device_data_lock, accounting for contention
+ */
+static void mm_bench_lock(struct mm_bench_player *player)
+{
+	ktime_t start;
+
+	player->locks++;
+	if (spin_trylock(&device_data_lock))
+		return;
+	player->contended++;
+	start = ktime_get();
+	spin_lock(&device_data_lock);
+	player->wait_ns += ktime_to_ns(ktime_sub(ktime_get(), start));
+}
+
+/**
+ * mm_bench_broadcast() - give the self-benchmark's games a new code
+ * @code: NUM_PEGS ASCII digits
+ *
+ * Like a network code change, but only for the benchmark's own games,
+ * so that neither real games nor the statistics are affected. Players
+ * that could not allocate a game are skipped.
+ */
+static void mm_bench_broadcast(const char *code)
+{
+	struct mm_game *game;
+	int pegs[NUM_PEGS];
+	unsigned i;
+
+	for (i = 0; i < NUM_PEGS; i++)
+		pegs[i] = code[i] - '0';
+	spin_lock(&device_data_lock);
+	for (i = 0; i < mm_bench_nplayers; i++) {
+		game = READ_ONCE(mm_bench_players[i].game);
+		if (game)
+			mm_game_new_code(game, pegs);
+	}
+	spin_unlock(&device_data_lock);
+}
+
+/**
+ * mm_bench_thread() - play a game, or broadcast code changes, until
+ * stopped
+ *
+ * Guesses go through mm_guess_locked(), as for mm_write(), and code
+ * changes through mm_game_new_code(), as for the fan-out of
+ * cs421net_bottom(). A player checks in through mm_bench_pending once
+ * its game is allocated.
+ */
+static int mm_bench_thread(void *data)
+{
+	struct mm_bench_player *player = data;
+	struct mm_game *game;
+	unsigned long n = player->cpu;
+	char code[NUM_PEGS];
+	unsigned black, white;
+	int retval;
+
+	/* on this CPU's node, as for a process playing here */
+	if (!player->broadcaster) {
+		game = mm_alloc_game(INVALID_UID);
+		if (game) {
+			INIT_LIST_HEAD(&game->list);
+			game->bench = true;
+			mm_start_game(game, 0);
+			WRITE_ONCE(player->game, game);
+		}
+	}
+	if (atomic_dec_and_test(&mm_bench_pending))
+		complete(&mm_bench_ready);
+	wait_for_completion(&mm_bench_go);
+	while (!kthread_should_stop()) {
+		mm_bench_code(code, n++);
+		if (player->broadcaster) {
+			mm_bench_broadcast(code);
+			player->ops++;
+		} else if (player->game) {
+			mm_bench_lock(player);
+			retval = mm_guess_locked(player->game, code, &black, &white, NULL);
+			spin_unlock(&device_data_lock);
+			if (retval) {
+				mm_start_game(player->game, 0);
+				player->starts++;
+			} else
+				player->ops++;
+		}
+		cond_resched();
 	}
+	return 0;
+}
 
-	current_message_buffer_pointer += scnprintf(message_to_write, 19, "Number of colors: ");
-	buffer_size+=19;
-	temp_array_size = convert_number_to_array(NUM_COLORS, &temp_number_array);
-	current_message_buffer_pointer += scnprintf(message_to_write + current_message_buffer_pointer, temp_array_size + 1, temp_number_array);
-	buffer_size+=temp_array_size+1;
+/**
+ * mm_bench_run() - run a self-benchmark and write its report
+ * @threads: number of player kthreads, spread over the online CPUs
+ * @ms: how long to run, in milliseconds
+ * @broadcast: whether one more kthread broadcasts code changes to the
+ * benchmark's games meanwhile
+ *
+ * Caller must hold mm_bench_mutex.
+ *
+ * Return: 0 on success, negative on error
+ */
+static int mm_bench_run(unsigned threads, unsigned ms, bool broadcast)
+{
+	struct mm_bench_player *players, *player;
+	unsigned total = threads + broadcast, started = 0, i;
+	u64 guesses = 0, starts = 0, codes = 0, locks = 0, contended = 0, wait_ns = 0;
+	u64 elapsed_ns;
+	ktime_t start;
+	size_t len;
+	int cpu = -1, retval = 0;
 
-	current_message_buffer_pointer += scnprintf(message_to_write + current_message_buffer_pointer, 28, "\nNumber of started games: ");
-	buffer_size+=28;
-	temp_array_size = convert_number_to_array(games_started, &temp_number_array);
-	current_message_buffer_pointer += scnprintf(message_to_write + current_message_buffer_pointer, temp_array_size + 1, temp_number_array);
-	buffer_size+=temp_array_size+1;
+	players = kcalloc(total, sizeof(*players), GFP_KERNEL);
+	if (!players)
+		return -ENOMEM;
+	reinit_completion(&mm_bench_go);
+	reinit_completion(&mm_bench_ready);
+	/* one for this thread, so that the count only drops to 0 below */
+	atomic_set(&mm_bench_pending, 1);
+	mm_bench_players = players;
+	mm_bench_nplayers = threads;
+	for (i = 0; i < total; i++) {
+		player = &players[i];
+		cpu = cpumask_next(cpu, cpu_online_mask);
+		if (cpu >= nr_cpu_ids)
+			cpu = cpumask_first(cpu_online_mask);
+		player->cpu = cpu;
+		player->broadcaster = i >= threads;
+		player->task = kthread_create_on_node(mm_bench_thread, player, cpu_to_node(cpu),
+						      "mm_bench/%u", i);
+		if (IS_ERR(player->task)) {
+			retval = PTR_ERR(player->task);
+			player->task = NULL;
+			break;
+		}
+		kthread_bind(player->task, cpu);
+		atomic_inc(&mm_bench_pending);
+		wake_up_process(player->task);
+		started++;
+	}
 
-	current_message_buffer_pointer += scnprintf(message_to_write + current_message_buffer_pointer, 27, "\nNumber of active games: ");
-	buffer_size+=27;
-	temp_array_size = convert_number_to_array(games_active, &temp_number_array);
-	current_message_buffer_pointer += scnprintf(message_to_write + current_message_buffer_pointer, temp_array_size + 1, temp_number_array);
-	buffer_size+=temp_array_size+1;
+	/* so that kthread_stop() cannot keep a player from allocating its game */
+	if (!atomic_dec_and_test(&mm_bench_pending))
+		wait_for_completion(&mm_bench_ready);
+	start = ktime_get();
+	complete_all(&mm_bench_go);
+	if (!retval)
+		msleep_interruptible(ms);
+	for (i = 0; i < started; i++)
+		kthread_stop(players[i].task);
+	elapsed_ns = max_t(u64, ktime_to_ns(ktime_sub(ktime_get(), start)), 1);
 
-	current_message_buffer_pointer += scnprintf(message_to_write + current_message_buffer_pointer, 37, "\nNumber of times code was changed: ");
-	buffer_size+=37;
-	temp_array_size = convert_number_to_array(codes_changed, &temp_number_array);
-	current_message_buffer_pointer += scnprintf(message_to_write + current_message_buffer_pointer, temp_array_size + 1, temp_number_array);
-	buffer_size+=temp_array_size+1;
+	for (i = 0; i < started; i++) {
+		player = &players[i];
+		if (player->broadcaster)
+			codes += player->ops;
+		if (!player->game) {
+			if (!player->broadcaster)
+				retval = -ENOMEM;
+			continue;
+		}
+		guesses += player->ops;
+		starts += player->starts;
+		locks += player->locks;
+		contended += player->contended;
+		wait_ns += player->wait_ns;
+		spin_lock(&device_data_lock);
+		mm_end_game(player->game);
+		spin_unlock(&device_data_lock);
+		mm_put_game(player->game);
+	}
+	mm_bench_players = NULL;
+	mm_bench_nplayers = 0;
+	kfree(players);
+	if (retval)
+		return retval;
 
-	current_message_buffer_pointer += scnprintf(message_to_write + current_message_buffer_pointer, 43, "\nNumber of invalid code change attempts: ");
-	buffer_size+=43;
-	temp_array_size = convert_number_to_array(invalid_attempts, &temp_number_array);
-	current_message_buffer_pointer += scnprintf(message_to_write + current_message_buffer_pointer, temp_array_size + 1, temp_number_array);
-	buffer_size+=temp_array_size+1;
+	len = scnprintf(mm_bench_report, sizeof(mm_bench_report),
+			"threads %u, code changes %s, %llu ms\n"
+			"guesses %llu, %llu per second\n"
+			"games started %llu\n"
+			"code changes %llu, %llu per second\n"
+			"device_data_lock contended %llu of %llu times, %llu ns spinning\n",
+			threads, broadcast ? "on" : "off", div_u64(elapsed_ns, NSEC_PER_MSEC),
+			guesses, div64_u64(guesses * NSEC_PER_SEC, elapsed_ns), starts,
+			codes, div64_u64(codes * NSEC_PER_SEC, elapsed_ns),
+			contended, locks, wait_ns);
+	mm_bench_report_len = len;
+	return 0;
+}
 
-	current_message_buffer_pointer += scnprintf(message_to_write + current_message_buffer_pointer, 2, "\n");
-	buffer_size+=temp_array_size+2;
+static ssize_t mm_bench_read(struct file *filp, char __user *ubuf, size_t count,
+			     loff_t *ppos)
+{
+	ssize_t retval;
 
-	scnprintf(buf, buffer_size+1, message_to_write);
-	return buffer_size+1;
+	mutex_lock(&mm_bench_mutex);
+	retval = simple_read_from_buffer(ubuf, count, ppos, mm_bench_report,
+					 mm_bench_report_len);
+	mutex_unlock(&mm_bench_mutex);
+	return retval;
 }
 
-static DEVICE_ATTR(stats, S_IRUGO, mm_stats_show, NULL);
+/**
+ * mm_bench_write() - run a self-benchmark
+ *
+ * Write "THREADS MILLISECONDS [BROADCAST]": THREADS kthreads, bound
+ * round-robin to the online CPUs, each play their own game as fast as
+ * they can for MILLISECONDS. If BROADCAST is nonzero, one more kthread
+ * broadcasts code changes to those games all the while. The write
+ * returns once the run is over, or early on a signal, and its report is
+ * then read from the same file.
+ *
+ * Return: @count, or negative on error
+ */
+static ssize_t mm_bench_write(struct file *filp, const char __user *ubuf,
+			      size_t count, loff_t *ppos)
+{
+	unsigned threads, ms, broadcast = 0;
+	char buf[32];
+	int retval;
+
+	if (count >= sizeof(buf))
+		return -EINVAL;
+	if (copy_from_user(buf, ubuf, count))
+		return -EFAULT;
+	buf[count] = '\0';
+	if (sscanf(buf, "%u %u %u", &threads, &ms, &broadcast) < 2 ||
+	    !threads || threads > MM_BENCH_MAX_THREADS || !ms || ms > MM_BENCH_MAX_MS)
+		return -EINVAL;
+	if (mutex_lock_interruptible(&mm_bench_mutex))
+		return -ERESTARTSYS;
+	retval = mm_bench_run(threads, ms, broadcast);
+	mutex_unlock(&mm_bench_mutex);
+	return retval ? retval : count;
+}
+
+static const struct file_operations mm_bench_fops = {
+	.owner = THIS_MODULE,
+	.read = mm_bench_read,
+	.write = mm_bench_write,
+	.llseek = default_llseek,
+};
+
+/**
+ * mm_free_user_games() - drop the registry's per-user games, when
+ * unloading
+ *
+ * Open files pin the module, so only per-user games are left.
+ */
+static void mm_free_user_games(void)
+{
+	struct mm_game *game, *tmp;
+
+	list_for_each_entry_safe(game, tmp, &game_list, list) {
+		list_del_init(&game->list);
+		mm_put_game(game);
+	}
+	games_allocated = 0;
+}
 
 /**
  * mastermind_probe() - callback invoked when this driver is probed
@@ -710,21 +4528,42 @@ static int mastermind_probe(struct platform_device *pdev)
 {
 	/* Merge the contents of your original mastermind_init() here. */
 	/* Part 1: YOUR CODE HERE */
+	static const int arena_default[NUM_PEGS] = { 4, 2, 1, 1 };
 	int retval;
+	int colors;
 	pr_info("Initializing the game.\n");
+	mm_game_cache = KMEM_CACHE(mm_game, SLAB_HWCACHE_ALIGN);
+	if (!mm_game_cache)
+		return -ENOMEM;
+	mm_shards_init();
+	retval = mm_arena_publish(arena_default, NUM_COLORS);
+	if (retval)
+		goto err_arena;
 	retval = misc_register(&mastermind_device);
 	if (retval)
 	{
 		printk("There was some error while registering main device.");
 		pr_err("can't misc_register :(\n");
-		return retval;
+		goto err_mm;
 	}
 	retval = misc_register(&mastermind_ctl_device);
 	if (retval)
 	{
 		printk("There was some error while registering control device.");
 		pr_err("can't misc_register :(\n");
-		return retval;
+		goto err_ctl;
+	}
+	retval = misc_register(&mastermind_history_device);
+	if (retval)
+	{
+		pr_err("can't misc_register history device\n");
+		goto err_history;
+	}
+	retval = misc_register(&mastermind_snapshot_device);
+	if (retval)
+	{
+		pr_err("can't misc_register snapshot device\n");
+		goto err_snapshot;
 	}
 
 	/*
@@ -736,12 +4575,47 @@ static int mastermind_probe(struct platform_device *pdev)
 	retval = request_threaded_irq(CS421NET_IRQ, cs421net_top, cs421net_bottom, IRQF_TRIGGER_NONE, "CS421IRQ", NULL);
 	if(retval){
 		pr_err("Could not create a threaded irq\n");
+		goto err_irq;
 	}
-	retval = device_create_file(&pdev->dev, &dev_attr_stats);
-	if (retval) {
-		pr_err("Could not create sysfs entry\n");
+	mm_snapshot_load_firmware(&pdev->dev);
+	if (!net_irq) {
+		net_consumer = !cs421net_register_consumer(mm_net_consume, NULL);
+		if (!net_consumer)
+			pr_warn("CS421Net already has a consumer, using its interrupt\n");
 	}
+	if (device_create_file(&pdev->dev, &dev_attr_stats))
+		pr_warn("Could not create sysfs entry\n");
+	if (device_create_file(&pdev->dev, &dev_attr_leaderboard))
+		pr_warn("Could not create leaderboard sysfs entry\n");
+	mm_debugfs = debugfs_create_dir("mastermind", NULL);
+	debugfs_create_file("games", 0400, mm_debugfs, NULL, &mm_games_fops);
+	debugfs_create_file("bench", 0600, mm_debugfs, NULL, &mm_bench_fops);
 	cs421net_enable();
+	schedule_delayed_work(&reclaim_work, MM_RECLAIM_INTERVAL);
+	if (register_shrinker(&mm_shrinker))
+		pr_warn("Could not register shrinker, user views stay in memory\n");
+	return 0;
+
+err_irq:
+	misc_deregister(&mastermind_snapshot_device);
+err_snapshot:
+	misc_deregister(&mastermind_history_device);
+err_history:
+	misc_deregister(&mastermind_ctl_device);
+err_ctl:
+	misc_deregister(&mastermind_device);
+	/* what users did through the devices meanwhile, as in mastermind_remove() */
+	mm_rate_reclaim(true);
+	mm_free_user_games();
+	cancel_work_sync(&score_table_work);
+	for (colors = 2; colors <= MM_MAX_COLORS; colors++)
+		mm_score_table_unpublish(colors);
+	mm_players_free();
+err_mm:
+	kfree(rcu_dereference_protected(arena_code, true));
+	RCU_INIT_POINTER(arena_code, NULL);
+err_arena:
+	kmem_cache_destroy(mm_game_cache);
 	return retval;
 }
 
@@ -755,23 +4629,35 @@ static int mastermind_remove(struct platform_device *pdev)
 {
 	/* Merge the contents of your original mastermind_exit() here. */
 	/* Part 1: YOUR CODE HERE */
-	struct list_head *pos, *n;
-	struct mm_game *temp;
+	int colors;
 
 	pr_info("Freeing resources.\n");
-	 for (pos = game_list.next, n = pos->next; pos != game_list.next; pos = n, n = pos->next){
-		 temp = list_entry(pos, struct mm_game, list);
-		 list_del(pos);
-		 vfree(temp->user_view);
-		 vfree(temp);
-	 }
-
 	misc_deregister(&mastermind_device);
 	misc_deregister(&mastermind_ctl_device);
+	misc_deregister(&mastermind_history_device);
+	misc_deregister(&mastermind_snapshot_device);
+	debugfs_remove_recursive(mm_debugfs);
+	cancel_delayed_work_sync(&reclaim_work);
+	unregister_shrinker(&mm_shrinker);
+	mm_rate_reclaim(true);
+
+	mm_free_user_games();
 
+	if (net_consumer)
+		cs421net_unregister_consumer();
 	free_irq(CS421NET_IRQ, NULL);
+	cancel_work_sync(&mm_fanout_work);
+	/* no game is left to score against it, nor a code change to replace it */
+	kfree(rcu_dereference_protected(arena_code, true));
+	RCU_INIT_POINTER(arena_code, NULL);
+	cancel_work_sync(&score_table_work);
+	for (colors = 2; colors <= MM_MAX_COLORS; colors++)
+		mm_score_table_unpublish(colors);
 cs421net_disable();
 	device_remove_file(&pdev->dev, &dev_attr_stats);
+	device_remove_file(&pdev->dev, &dev_attr_leaderboard);
+	mm_players_free();
+	kmem_cache_destroy(mm_game_cache);
 	return 0;
 }
 
@@ -0,0 +1,189 @@
+/*
+ * Declarations shared between the Mastermind module and its clients.
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License version 2 as
+ * published by the Free Software Foundation.
+ */
+
+#ifndef MASTERMIND2_H
+#define MASTERMIND2_H
+
+#include <linux/ioctl.h>
+#include <linux/types.h>
+
+#define MM_NUM_PEGS 4
+
+/** largest number of colors accepted by "colors N" */
+#define MM_MAX_COLORS 9
+
+/**
+ * struct mm_solve - result of MM_IOC_SOLVE
+ * @remaining: number of codes still consistent with the game's history
+ * @space: total number of codes for the game's board
+ * @guess: suggested next guess, as ASCII digits; all '?' if
+ * @remaining is zero
+ */
+struct mm_solve {
+	__u32 remaining;
+	__u32 space;
+	char guess[MM_NUM_PEGS];
+};
+
+/** a score packed into one byte, black pegs in the high nibble */
+#define MM_SCORE(black, white) ((__u8)((black) << 4 | (white)))
+#define MM_SCORE_BLACK(score) ((score) >> 4)
+#define MM_SCORE_WHITE(score) ((score) & 0xf)
+
+/**
+ * struct mm_candidate_view - layout of the page mapped at
+ * MM_MMAP_CANDIDATES_PGOFF on /dev/mm
+ * @remaining: number of codes still consistent with the game's history
+ * @space: total number of codes for the game's board
+ * @bits: one bit per code, set if still consistent; code index i is
+ * bit (i % 64) of bits[i / 64], and the first peg is the most
+ * significant base-colors digit of i
+ */
+struct mm_candidate_view {
+	__u32 remaining;
+	__u32 space;
+	__u64 bits[];
+};
+
+/** mmap() page offset of the caller's struct mm_candidate_view */
+#define MM_MMAP_CANDIDATES_PGOFF 256
+
+/**
+ * mmap() page offset of the shared score table for the caller's board.
+ * With space = colors^MM_NUM_PEGS codes, byte (guess * space + code)
+ * is the MM_SCORE() of that pair. Only boards of up to 4096 codes have
+ * a table.
+ */
+#define MM_MMAP_SCORES_PGOFF 512
+
+/** first four bytes of a snapshot read from /dev/mm_snapshot, "MMSS" */
+#define MM_SNAPSHOT_MAGIC 0x53534d4d
+#define MM_SNAPSHOT_VERSION 1
+
+/**
+ * struct mm_snapshot_header - start of a registry snapshot
+ * @magic: MM_SNAPSHOT_MAGIC
+ * @version: MM_SNAPSHOT_VERSION
+ * @num_games: number of struct mm_snapshot_game records that follow
+ * @colors: number of colors for new games
+ * @games_started: number of games started
+ * @codes_changed: number of times the code was changed over CS421Net
+ * @invalid_attempts: number of invalid code change attempts
+ * @reserved: must be zero
+ *
+ * All fields are in host byte order. Each game record is followed
+ * directly by its @history_len struct mm_snapshot_guess records.
+ */
+struct mm_snapshot_header {
+	__u32 magic;
+	__u32 version;
+	__u32 num_games;
+	__u32 colors;
+	__u32 games_started;
+	__u32 codes_changed;
+	__u32 invalid_attempts;
+	__u32 reserved;
+};
+
+/**
+ * struct mm_snapshot_game - one per-user game in a snapshot
+ * @uid: owning user, in the initial user namespace
+ * @num_guesses: guesses made, including those past the recorded history
+ * @history_len: number of struct mm_snapshot_guess records that follow
+ * @active: 1 if the game is in progress
+ * @colors: number of colors on the game's board
+ * @target: target code, one peg value per byte
+ * @last_result: result of the last guess, as returned by read()
+ * @reserved: must be zero
+ */
+struct mm_snapshot_game {
+	__u32 uid;
+	__u32 num_guesses;
+	__u32 history_len;
+	__u8 active;
+	__u8 colors;
+	__u8 target[MM_NUM_PEGS];
+	char last_result[MM_NUM_PEGS];
+	__u8 reserved[2];
+};
+
+/**
+ * struct mm_snapshot_guess - one recorded guess and its score
+ * @guess: the guess as written to /dev/mm
+ * @black: pegs of the right color in the right position
+ * @white: further pegs of the right color
+ */
+struct mm_snapshot_guess {
+	char guess[MM_NUM_PEGS];
+	__u8 black;
+	__u8 white;
+};
+
+/**
+ * struct mm_start - argument of MM_IOC_START
+ * @colors: number of colors on the new game's board, from 2 to
+ * MM_MAX_COLORS, or 0 for the current default
+ * @reserved: must be zero
+ */
+struct mm_start {
+	__u32 colors;
+	__u32 reserved;
+};
+
+/**
+ * struct mm_state - result of MM_IOC_GET_STATE
+ * @active: 1 if the game is in progress
+ * @colors: number of colors on the game's board
+ * @num_guesses: number of guesses made in the game
+ * @history_len: number of guesses recorded in the user view
+ * @last_result: what read() on /dev/mm would return
+ */
+struct mm_state {
+	__u32 active;
+	__u32 colors;
+	__u32 num_guesses;
+	__u32 history_len;
+	char last_result[MM_NUM_PEGS];
+};
+
+/**
+ * struct mm_guess - argument and result of MM_IOC_GUESS
+ * @guess: the guess, as ASCII digits like a write() to /dev/mm
+ * @black: set to the number of pegs of the right color in the right
+ * position
+ * @white: set to the number of further pegs of the right color
+ * @reserved: must be zero
+ */
+struct mm_guess {
+	char guess[MM_NUM_PEGS];
+	__u8 black;
+	__u8 white;
+	__u8 reserved[2];
+};
+
+#define MM_IOC_MAGIC 'M'
+
+/*
+ * ioctls on /dev/mm and /dev/mm_ctl. On /dev/mm_ctl, and on /dev/mm
+ * unless it was opened with per_file_games set, they act on the
+ * caller's per-user game.
+ */
+#define MM_IOC_SOLVE _IOR(MM_IOC_MAGIC, 1, struct mm_solve)
+#define MM_IOC_START _IOW(MM_IOC_MAGIC, 2, struct mm_start)
+#define MM_IOC_QUIT _IO(MM_IOC_MAGIC, 3)
+/* change the default number of colors; needs CAP_SYS_ADMIN */
+#define MM_IOC_SET_COLORS _IOW(MM_IOC_MAGIC, 4, __u32)
+#define MM_IOC_GET_STATE _IOR(MM_IOC_MAGIC, 5, struct mm_state)
+#define MM_IOC_GUESS _IOWR(MM_IOC_MAGIC, 6, struct mm_guess)
+/*
+ * on /dev/mm only: nonzero makes reads past the result wait for the
+ * game to change instead of returning 0, for the open file alone
+ */
+#define MM_IOC_FOLLOW _IOW(MM_IOC_MAGIC, 7, __u32)
+
+#endif
@@ -1,5 +1,6 @@
 /*
- * Raise an interrupt upon each target skb, storing it for later
+ * Hand each target skb's payload to the registered consumer, or, if
+ * there is none, raise an interrupt upon it, storing it for later
  * processing.
  *
  * Copyright(c) 2016-2019 Jason Tang <jtang@umbc.edu>
@@ -12,9 +13,18 @@
 #define pr_fmt(fmt) "CS421Net: " fmt
 
 #include <linux/completion.h>
+#include <linux/fs.h>
+#include <linux/hashtable.h>
+#include <linux/jhash.h>
+#include <linux/jiffies.h>
+#include <linux/miscdevice.h>
 #include <linux/module.h>
+#include <linux/moduleparam.h>
 #include <linux/skbuff.h>
+#include <linux/slab.h>
 #include <linux/spinlock.h>
+#include <linux/timer.h>
+#include <linux/uio.h>
 #include <linux/workqueue.h>
 
 #include <linux/netfilter.h>
@@ -29,6 +39,43 @@
 extern int trigger_irq(unsigned);
 
 #define CS421NET_IRQ 6
+#define CS421NET_PORT 4210
+
+/* largest message reassembled from a stream */
+#define CS421NET_FRAME_MAX 512
+
+/* streams not seen for this long are forgotten */
+#define CS421NET_FLOW_TIMEOUT (60 * HZ)
+
+enum cs421net_framing {
+	CS421NET_FRAMING_SEGMENT,
+	CS421NET_FRAMING_FIXED,
+	CS421NET_FRAMING_LENGTH,
+};
+
+/* both set through cs421net_framing_ops, which resets partial messages */
+static int framing = CS421NET_FRAMING_SEGMENT;
+MODULE_PARM_DESC(framing, "How TCP payloads split into messages: 0 one per segment (default), 1 frame_size bytes each, 2 each after a big-endian 16-bit length");
+
+static unsigned frame_size = 4;
+MODULE_PARM_DESC(frame_size, "Message length when framing is 1 (default: 4)");
+
+static unsigned max_flows = 256;
+module_param(max_flows, uint, 0644);
+MODULE_PARM_DESC(max_flows, "Most TCP streams reassembled at once; segments of further streams are dropped (default: 256)");
+
+static unsigned long flows_dropped;
+module_param(flows_dropped, ulong, 0444);
+MODULE_PARM_DESC(flows_dropped, "Number of segments dropped because max_flows streams were being reassembled");
+
+static bool capture = true;
+module_param(capture, bool, 0644);
+MODULE_PARM_DESC(capture, "Take payloads from the netfilter hook (default: on)");
+
+static unsigned xdp_max_len;
+module_param(xdp_max_len, uint, 0644);
+MODULE_PARM_DESC(xdp_max_len, "With framing 0, leave payloads of at most this many bytes to cs421net-xdp, which sets it while it runs (default: 0, none)");
+
 static DEFINE_SPINLOCK(lock);
 static DECLARE_COMPLETION(retrieved);
 static bool cs421net_enabled;
@@ -41,6 +88,86 @@ struct incoming_data {
 };
 static LIST_HEAD(cs421net_list);
 
+/**
+ * struct cs421net_flow - reassembly state of one TCP connection
+ * @node: entry in cs421net_flows
+ * @lru: entry in cs421net_flow_lru
+ * @saddr: source address
+ * @daddr: destination address
+ * @sport: source port
+ * @dport: destination port
+ * @next_seq: sequence number of the next byte expected
+ * @last_seen: jiffies when the last segment arrived
+ * @len: bytes of the current message in @buf so far, including its
+ * length prefix
+ * @buf: the current message
+ */
+struct cs421net_flow {
+	struct hlist_node node;
+	struct list_head lru;
+	__be32 saddr, daddr;
+	__be16 sport, dport;
+	u32 next_seq;
+	unsigned long last_seen;
+	/* framing and frame length as of the start of the current message */
+	int framing;
+	size_t frame_size;
+	size_t len;
+	u8 buf[2 + CS421NET_FRAME_MAX];
+};
+
+/* flows by cs421net_flow_hash(), under flow_lock */
+static DEFINE_HASHTABLE(cs421net_flows, 6);
+static DEFINE_SPINLOCK(flow_lock);
+/* the same flows, least recently seen first, and how many there are */
+static LIST_HEAD(cs421net_flow_lru);
+static unsigned cs421net_nflows;
+
+/**
+ * cs421net_framing_set() - set the framing or frame_size parameter
+ * @val: new value, as text
+ * @kp: the parameter
+ *
+ * Partial messages were split under the old value, so every flow
+ * starts over with its next message.
+ *
+ * Return: 0 on success, negative on error
+ */
+static int cs421net_framing_set(const char *val, const struct kernel_param *kp)
+{
+	struct cs421net_flow *flow;
+	int retval;
+
+	spin_lock_bh(&flow_lock);
+	if (kp->arg == &framing)
+		retval = param_set_int(val, kp);
+	else
+		retval = param_set_uint(val, kp);
+	if (!retval)
+		list_for_each_entry(flow, &cs421net_flow_lru, lru)
+			flow->len = 0;
+	spin_unlock_bh(&flow_lock);
+	return retval;
+}
+
+static int cs421net_framing_get(char *buffer, const struct kernel_param *kp)
+{
+	if (kp->arg == &framing)
+		return param_get_int(buffer, kp);
+	return param_get_uint(buffer, kp);
+}
+
+static const struct kernel_param_ops cs421net_framing_ops = {
+	.set = cs421net_framing_set,
+	.get = cs421net_framing_get,
+};
+module_param_cb(framing, &cs421net_framing_ops, &framing, 0644);
+module_param_cb(frame_size, &cs421net_framing_ops, &frame_size, 0644);
+
+/* registered consumer, under lock; NULL to raise interrupts instead */
+static cs421net_consumer_fn cs421net_consumer;
+static void *cs421net_consumer_priv;
+
 /**
  * cs421net_enable() - start capturing data from the network
  *
@@ -113,79 +240,442 @@ EXPORT_SYMBOL(cs421net_get_data);
 /**
  * cs421net_work_func() - function invoked by the workqueue
  *
- * Raise an interrupt, then wait for the interrupt handler to
+ * If a consumer is registered, pass it every pending payload in turn.
+ * Otherwise raise an interrupt, then wait for the interrupt handler to
  * acknowledge the interrupt.
  */
 static void cs421net_work_func(struct work_struct *work)
 {
-	if (trigger_irq(CS421NET_IRQ) < 0)
-		pr_err("Could not generate interrupt\n");
+	cs421net_consumer_fn consumer;
+	unsigned long flags;
+	void *priv;
+	char *payload;
+	size_t len;
+
+	spin_lock_irqsave(&lock, flags);
+	consumer = cs421net_consumer;
+	priv = cs421net_consumer_priv;
+	spin_unlock_irqrestore(&lock, flags);
+
+	if (!consumer) {
+		if (trigger_irq(CS421NET_IRQ) < 0)
+			pr_err("Could not generate interrupt\n");
+		return;
+	}
+	while ((payload = cs421net_get_data(&len)) != NULL) {
+		consumer(payload, len, priv);
+		kfree(payload);
+	}
 }
 
 static DECLARE_WORK(cs421net_work, cs421net_work_func);
 
 /**
- * cs421net_hook() - log incoming data from CS421Net
+ * cs421net_register_consumer() - receive payloads through a callback
+ * instead of the interrupt
+ * @consumer: called from process context with each payload, in order
+ * of arrival; the payload is freed when it returns
+ * @priv: passed to @consumer
+ *
+ * Payloads already pending are handed to @consumer too. There can be
+ * only one consumer at a time.
  *
- * For each skb, add the payload to the list and schedule an
- * interrupt.
+ * Return: 0 on success, -EBUSY if a consumer is already registered
  */
-static unsigned int
-cs421net_hook(void *priv, struct sk_buff *skb,
-	      const struct nf_hook_state *state)
+int cs421net_register_consumer(cs421net_consumer_fn consumer, void *priv)
 {
-	struct iphdr *iph;
-	struct tcphdr *tcph;
-	char *payload_data;
-	unsigned payload_len;
-	struct incoming_data *data;
 	unsigned long flags;
+	int retval = 0;
 
-	if (!cs421net_enabled)
-		goto out;
+	spin_lock_irqsave(&lock, flags);
+	if (cs421net_consumer) {
+		retval = -EBUSY;
+	} else {
+		cs421net_consumer = consumer;
+		cs421net_consumer_priv = priv;
+	}
+	spin_unlock_irqrestore(&lock, flags);
+	if (!retval && !list_empty(&cs421net_list))
+		queue_work(cs421net_wq, &cs421net_work);
+	return retval;
+}
 
-	if (!skb)
-		goto out;
-	iph = ip_hdr(skb);
-	if (!iph || iph->protocol != IPPROTO_TCP)
-		goto out;
-	tcph = tcp_hdr(skb);
-	if (!tcph || ntohs(tcph->dest) != 4210)
-		goto out;
+EXPORT_SYMBOL(cs421net_register_consumer);
+
+/**
+ * cs421net_unregister_consumer() - go back to raising interrupts
+ *
+ * On return, the consumer is no longer being called and will not be
+ * called again.
+ */
+void cs421net_unregister_consumer(void)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&lock, flags);
+	cs421net_consumer = NULL;
+	cs421net_consumer_priv = NULL;
+	spin_unlock_irqrestore(&lock, flags);
+	flush_work(&cs421net_work);
+}
+
+EXPORT_SYMBOL(cs421net_unregister_consumer);
+
+/**
+ * cs421net_queue() - add a copy of a message to the list
+ * @skb: skb holding the message, or %NULL if it is in @buf
+ * @offset: offset of the message in @skb
+ * @buf: the message if @skb is %NULL
+ * @len: length of the message
+ *
+ * Return: true if queued, false if out of memory
+ */
+static bool cs421net_queue(const struct sk_buff *skb, unsigned offset,
+			   const void *buf, size_t len)
+{
+	struct incoming_data *data;
+	unsigned long flags;
 
-	payload_data = skb_network_header(skb) + (iph->ihl * 4) +
-	    (tcph->doff * 4);
-	payload_len = ntohs(iph->tot_len) - (iph->ihl * 4) - (tcph->doff * 4);
-	if (payload_len == 0)
-		goto out;
 	data = kmalloc(sizeof(*data), GFP_ATOMIC);
 	if (!data)
-		goto out;
-	data->len = payload_len;
-	data->data = kzalloc(100, GFP_ATOMIC);
+		return false;
+	data->len = len;
+	data->data = kmalloc(len, GFP_ATOMIC);
 	if (!data->data)
 		goto out_free_node;
-	if (skb_copy_bits(skb, iph->ihl * 4 + tcph->doff * 4,
-			  data->data, payload_len))
+	if (!skb)
+		memcpy(data->data, buf, len);
+	else if (skb_copy_bits(skb, offset, data->data, len))
 		goto out_free_data_buf;
 
 	spin_lock_irqsave(&lock, flags);
 	list_add_tail(&data->list, &cs421net_list);
 	spin_unlock_irqrestore(&lock, flags);
-	pr_info("Raising IRQ %u for payload length %zu\n", CS421NET_IRQ,
-		data->len);
-	queue_work(cs421net_wq, &cs421net_work);
-
-	goto out;
+	return true;
 
 out_free_data_buf:
 	kfree(data->data);
 out_free_node:
 	kfree(data);
+	return false;
+}
+
+static u32 cs421net_flow_hash(const struct iphdr *iph, const struct tcphdr *tcph)
+{
+	return jhash_3words((__force u32)iph->saddr, (__force u32)iph->daddr,
+			    ((__force u32)tcph->source << 16) | (__force u32)tcph->dest, 0);
+}
+
+static void cs421net_flow_free(struct cs421net_flow *flow)
+{
+	hash_del(&flow->node);
+	list_del(&flow->lru);
+	cs421net_nflows--;
+	kfree(flow);
+}
+
+/**
+ * cs421net_flow_expire() - forget flows idle for CS421NET_FLOW_TIMEOUT
+ *
+ * Only the idle flows at the head of cs421net_flow_lru are visited.
+ *
+ * Caller must hold flow_lock.
+ */
+static void cs421net_flow_expire(void)
+{
+	struct cs421net_flow *flow, *tmp;
+
+	list_for_each_entry_safe(flow, tmp, &cs421net_flow_lru, lru) {
+		if (!time_after(jiffies, flow->last_seen + CS421NET_FLOW_TIMEOUT))
+			break;
+		cs421net_flow_free(flow);
+	}
+}
+
+/* forgets idle flows even when no segment arrives */
+static void cs421net_flow_timer_func(struct timer_list *timer)
+{
+	spin_lock(&flow_lock);
+	cs421net_flow_expire();
+	spin_unlock(&flow_lock);
+	mod_timer(timer, jiffies + CS421NET_FLOW_TIMEOUT);
+}
+
+static DEFINE_TIMER(cs421net_flow_timer, cs421net_flow_timer_func);
+
+/**
+ * cs421net_flow_get() - find or create the flow of a segment
+ *
+ * The flow becomes the most recently seen. Before a flow is created,
+ * idle ones are forgotten; if max_flows remain, the segment is dropped
+ * and counted in flows_dropped.
+ *
+ * Caller must hold flow_lock.
+ *
+ * Return: the flow, or %NULL if out of memory or at max_flows
+ */
+static struct cs421net_flow *cs421net_flow_get(const struct iphdr *iph,
+					       const struct tcphdr *tcph)
+{
+	struct cs421net_flow *flow;
+	u32 key = cs421net_flow_hash(iph, tcph);
+
+	hash_for_each_possible(cs421net_flows, flow, node, key) {
+		if (flow->saddr == iph->saddr && flow->daddr == iph->daddr &&
+		    flow->sport == tcph->source && flow->dport == tcph->dest) {
+			list_move_tail(&flow->lru, &cs421net_flow_lru);
+			return flow;
+		}
+	}
+	cs421net_flow_expire();
+	if (cs421net_nflows >= READ_ONCE(max_flows)) {
+		flows_dropped++;
+		return NULL;
+	}
+	flow = kzalloc(sizeof(*flow), GFP_ATOMIC);
+	if (!flow)
+		return NULL;
+	flow->saddr = iph->saddr;
+	flow->daddr = iph->daddr;
+	flow->sport = tcph->source;
+	flow->dport = tcph->dest;
+	flow->next_seq = ntohl(tcph->seq);
+	hash_add(cs421net_flows, &flow->node, key);
+	list_add_tail(&flow->lru, &cs421net_flow_lru);
+	cs421net_nflows++;
+	return flow;
+}
+
+/**
+ * cs421net_frame_len() - full length of @flow's current message
+ *
+ * Uses the framing and frame length @flow's message started with, so
+ * that changing the parameters cannot shrink a message below the bytes
+ * already buffered.
+ *
+ * Return: length including any length prefix, as far as known from the
+ * bytes in @flow->buf so far, or 0 if the prefix is invalid
+ */
+static size_t cs421net_frame_len(const struct cs421net_flow *flow)
+{
+	size_t len;
+
+	if (flow->framing != CS421NET_FRAMING_LENGTH)
+		return flow->frame_size;
+	if (flow->len < 2)
+		return 2;
+	len = (flow->buf[0] << 8) | flow->buf[1];
+	if (!len || len > CS421NET_FRAME_MAX)
+		return 0;
+	return 2 + len;
+}
+
+/**
+ * cs421net_reassemble() - split a segment's payload into messages
+ * @skb: the segment
+ * @iph: its IP header
+ * @tcph: its TCP header
+ * @offset: offset of the payload in @skb
+ * @len: length of the payload
+ *
+ * Bytes are taken in sequence order: retransmitted bytes are skipped,
+ * and a gap, such as after a lost segment, discards the partial message
+ * and starts over with the new segment. FIN and RST forget the flow.
+ *
+ * Return: true if a message was queued
+ */
+static bool cs421net_reassemble(const struct sk_buff *skb, const struct iphdr *iph,
+				const struct tcphdr *tcph, unsigned offset, unsigned len)
+{
+	struct cs421net_flow *flow;
+	u32 seq = ntohl(tcph->seq);
+	bool queued = false;
+	size_t need, chunk;
+	s32 delta;
+
+	spin_lock_bh(&flow_lock);
+	flow = cs421net_flow_get(iph, tcph);
+	if (!flow)
+		goto out;
+	flow->last_seen = jiffies;
+	if (tcph->syn) {
+		flow->next_seq = seq + 1;
+		flow->len = 0;
+	}
+	delta = seq - flow->next_seq;
+	if (delta > 0) {
+		pr_debug("Lost %d bytes, resynchronizing\n", delta);
+		flow->len = 0;
+	} else if (delta < 0) {
+		if ((u32)-delta >= len)
+			len = 0;
+		else {
+			offset -= delta;
+			len += delta;
+		}
+		seq = flow->next_seq;
+	}
+	flow->next_seq = seq + len;
+
+	while (len) {
+		if (!flow->len) {
+			flow->framing = framing;
+			flow->frame_size = clamp_t(size_t, frame_size, 1, CS421NET_FRAME_MAX);
+		}
+		need = cs421net_frame_len(flow);
+		if (!need || flow->len >= need) {
+			pr_debug("Discarding message of bad length\n");
+			flow->len = 0;
+			continue;
+		}
+		chunk = min_t(size_t, len, need - flow->len);
+		if (skb_copy_bits(skb, offset, flow->buf + flow->len, chunk)) {
+			flow->len = 0;
+			break;
+		}
+		flow->len += chunk;
+		offset += chunk;
+		len -= chunk;
+		if (flow->len < need ||
+		    (flow->framing == CS421NET_FRAMING_LENGTH && need == 2))
+			continue;
+		if (flow->framing == CS421NET_FRAMING_LENGTH)
+			queued |= cs421net_queue(NULL, 0, flow->buf + 2, need - 2);
+		else
+			queued |= cs421net_queue(NULL, 0, flow->buf, need);
+		flow->len = 0;
+	}
+
+	if (tcph->fin || tcph->rst)
+		cs421net_flow_free(flow);
+out:
+	spin_unlock_bh(&flow_lock);
+	return queued;
+}
+
+/**
+ * cs421net_hook() - log incoming data from CS421Net
+ *
+ * For each skb, add its payload to the list and schedule its delivery
+ * to the consumer, or an interrupt. Unless the framing parameter is 0,
+ * the payload is a piece of a byte stream, which may carry any number
+ * of messages; see cs421net_reassemble().
+ *
+ * Headers are read with skb_header_pointer() and the payload with
+ * skb_copy_bits(), so non-linear and GRO skbs work too.
+ */
+static unsigned int
+cs421net_hook(void *priv, struct sk_buff *skb,
+	      const struct nf_hook_state *state)
+{
+	const struct iphdr *iph;
+	const struct tcphdr *tcph;
+	struct tcphdr _tcph;
+	unsigned offset, payload_len;
+	bool queued;
+
+	if (!cs421net_enabled || !READ_ONCE(capture))
+		goto out;
+
+	if (!skb)
+		goto out;
+	iph = ip_hdr(skb);
+	if (!iph || iph->protocol != IPPROTO_TCP)
+		goto out;
+	tcph = skb_header_pointer(skb, iph->ihl * 4, sizeof(_tcph), &_tcph);
+	if (!tcph || ntohs(tcph->dest) != CS421NET_PORT)
+		goto out;
+
+	offset = iph->ihl * 4 + tcph->doff * 4;
+	if (skb->len < offset)
+		goto out;
+	payload_len = skb->len - offset;
+	if (framing == CS421NET_FRAMING_SEGMENT) {
+		/* relayed through /dev/cs421net by cs421net-xdp instead */
+		if (payload_len == 0 || payload_len <= READ_ONCE(xdp_max_len))
+			goto out;
+		queued = cs421net_queue(skb, offset, NULL, payload_len);
+	} else
+		queued = cs421net_reassemble(skb, iph, tcph, offset, payload_len);
+	if (queued)
+		queue_work(cs421net_wq, &cs421net_work);
+
 out:
 	return NF_ACCEPT;
 }
 
+/**
+ * cs421net_ingest_write_iter() - callback invoked for writes to
+ * /dev/cs421net
+ * @iocb: I/O control block of the write
+ * @from: messages to queue
+ *
+ * Each segment of @from is one message, queued as if it had arrived
+ * through the hook. cs421net-xdp relays the messages its XDP program
+ * captured this way, many per writev().
+ *
+ * Return: number of bytes queued, or negative on error
+ */
+static ssize_t cs421net_ingest_write_iter(struct kiocb *iocb, struct iov_iter *from)
+{
+	struct incoming_data *data;
+	unsigned long flags;
+	size_t len, done = 0;
+	LIST_HEAD(batch);
+	int retval = 0;
+
+	if (!cs421net_enabled)
+		return -EAGAIN;
+	while (iov_iter_count(from)) {
+		len = iov_iter_single_seg_count(from);
+		if (!len || len > CS421NET_FRAME_MAX) {
+			retval = -EINVAL;
+			break;
+		}
+		data = kmalloc(sizeof(*data), GFP_KERNEL);
+		if (!data) {
+			retval = -ENOMEM;
+			break;
+		}
+		data->data = kmalloc(len, GFP_KERNEL);
+		if (!data->data) {
+			kfree(data);
+			retval = -ENOMEM;
+			break;
+		}
+		if (copy_from_iter(data->data, len, from) != len) {
+			kfree(data->data);
+			kfree(data);
+			retval = -EFAULT;
+			break;
+		}
+		data->len = len;
+		list_add_tail(&data->list, &batch);
+		done += len;
+	}
+	if (!done)
+		return retval;
+
+	spin_lock_irqsave(&lock, flags);
+	list_splice_tail(&batch, &cs421net_list);
+	spin_unlock_irqrestore(&lock, flags);
+	queue_work(cs421net_wq, &cs421net_work);
+	return done;
+}
+
+static const struct file_operations cs421net_ingest_fops = {
+	.owner = THIS_MODULE,
+	.write_iter = cs421net_ingest_write_iter,
+	.llseek = noop_llseek,
+};
+
+static struct miscdevice cs421net_ingest_device = {
+	.minor = MISC_DYNAMIC_MINOR,
+	.name = "cs421net",
+	.fops = &cs421net_ingest_fops,
+	.mode = 0600,
+};
+
 static struct nf_hook_ops nf_cs421net = {
 	.hook = cs421net_hook,
 	.hooknum = NF_INET_LOCAL_IN,
@@ -202,9 +692,18 @@ static int __init cs421net_init(void)
 		retval = -ENOMEM;
 		goto out;
 	}
+	retval = misc_register(&cs421net_ingest_device);
+	if (retval < 0) {
+		destroy_workqueue(cs421net_wq);
+		goto out;
+	}
 	retval = nf_register_net_hook(&init_net, &nf_cs421net);
-	if (retval < 0)
+	if (retval < 0) {
+		misc_deregister(&cs421net_ingest_device);
 		destroy_workqueue(cs421net_wq);
+		goto out;
+	}
+	mod_timer(&cs421net_flow_timer, jiffies + CS421NET_FLOW_TIMEOUT);
 out:
 	pr_info("initialization returning %d\n", retval);
 	return retval;
@@ -213,9 +712,12 @@ out:
 static void __exit cs421net_exit(void)
 {
 	struct incoming_data *data, *tmp;
+	struct cs421net_flow *flow, *tmp_flow;
 
 	cs421net_enabled = false;
 	nf_unregister_net_hook(&init_net, &nf_cs421net);
+	del_timer_sync(&cs421net_flow_timer);
+	misc_deregister(&cs421net_ingest_device);
 	complete_all(&retrieved);
 	cancel_work_sync(&cs421net_work);
 	destroy_workqueue(cs421net_wq);
@@ -223,6 +725,8 @@ static void __exit cs421net_exit(void)
 		kfree(data->data);
 		kfree(data);
 	}
+	list_for_each_entry_safe(flow, tmp_flow, &cs421net_flow_lru, lru)
+		cs421net_flow_free(flow);
 	pr_info("exited\n");
 }
 
@@ -16,4 +16,14 @@ void cs421net_enable(void);
 void cs421net_disable(void);
 char *cs421net_get_data(size_t * const);
 
+/**
+ * typedef cs421net_consumer_fn - receiver of captured payloads
+ * @data: payload, NOT null-terminated, valid only during the call
+ * @len: length of @data
+ * @priv: pointer given to cs421net_register_consumer()
+ */
+typedef void (*cs421net_consumer_fn)(const char *data, size_t len, void *priv);
+int cs421net_register_consumer(cs421net_consumer_fn consumer, void *priv);
+void cs421net_unregister_consumer(void);
+
 #endif